@@ -0,0 +1,32 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Generates random learning set of arbitrary size for benchmarks,
+# rows are written one by one, so the set doesn't have to fit in memory
+
+import argparse
+import random
+import sys
+
+parser = argparse.ArgumentParser(description='Random learning set generator')
+parser.add_argument('output', help='output file, - for stdout')
+parser.add_argument('-n', '--rows', type=int, required=True, help='amount of objects')
+parser.add_argument('-f', '--features', type=int, required=True, help='amount of features')
+parser.add_argument('-c', '--classes', type=int, default=2, help='amount of classes')
+parser.add_argument('-v', '--values', type=int, default=5, help='amount of values of every feature')
+parser.add_argument('-d', '--dash', type=float, default=0.0, help='probability of dash')
+parser.add_argument('-s', '--seed', type=int, default=0, help='random seed')
+args = parser.parse_args()
+
+random.seed(args.seed)
+output = sys.stdout if args.output == '-' else open(args.output, 'w')
+
+output.write('learning_set: %d %d 1\n' % (args.rows, args.features))
+for i in range(args.rows):
+    row = ['-' if random.random() < args.dash else str(random.randrange(args.values))
+           for _ in range(args.features)]
+    output.write('%s  %d\n' % (' '.join(row), random.randrange(args.classes)))
+output.write('\n')
+
+if output is not sys.stdout:
+    output.close()
@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Runs uim calculation as several local processes with --shard k/N
+# and merges partial results with uim_merge
+
+import argparse
+import os
+import subprocess
+import tempfile
+
+parser = argparse.ArgumentParser(description='Sharded uim calculation on local processes')
+parser.add_argument('uim', help='uim_program binary')
+parser.add_argument('merge', help='uim_merge binary')
+parser.add_argument('input', help='input file')
+parser.add_argument('output', help='output file')
+parser.add_argument('-n', '--shards', type=int, default=2, help='amount of shards')
+parser.add_argument('--temp-dir', default='.', help='directory for partial results')
+args = parser.parse_args()
+
+temp_dir = tempfile.mkdtemp(prefix='uim_shards_', dir=args.temp_dir)
+parts = [os.path.join(temp_dir, 'part_%d.txt' % k) for k in range(1, args.shards + 1)]
+
+try:
+    processes = [subprocess.Popen([args.uim, args.input, part, '--shard', '%d/%d' % (k, args.shards)])
+                 for k, part in enumerate(parts, 1)]
+    for k, process in enumerate(processes, 1):
+        if process.wait() != 0:
+            raise RuntimeError('shard %d/%d failed' % (k, args.shards))
+
+    merge = subprocess.Popen([args.merge, '-', args.output], stdin=subprocess.PIPE)
+    merge.communicate('\n'.join(parts).encode())
+    if merge.returncode != 0:
+        raise RuntimeError('merge failed')
+finally:
+    for part in parts:
+        if os.path.exists(part):
+            os.remove(part)
+    os.rmdir(temp_dir)
@@ -0,0 +1,244 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "global_settings.h"
+#include "timecollector.hpp"
+
+const char CHECKPOINT_MAGIC[] = "UIMCKPT3";
+const int CHECKPOINT_MAGIC_LEN = 8;
+
+// Input key is stored as fixed size hex string after the magic
+const size_t CHECKPOINT_KEY_LEN = 32;
+
+Checkpoint::Checkpoint(const std::string& path, int interval, int tasksCount, const std::string& inputKey)
+    : _path(path),
+      _interval(interval),
+      _tasksCount(tasksCount),
+      _inputKey(inputKey),
+      _irredundantMatrix(nullptr),
+      _completed(tasksCount, false),
+      _activeTasks(0),
+      _pauseRequested(false),
+      _stopped(true)
+{
+    _inputKey.resize(CHECKPOINT_KEY_LEN, ' ');
+}
+
+Checkpoint::~Checkpoint()
+{
+    // Error of the writer is lost when calculation is interrupted by other one
+    try {
+        stop();
+    } catch (...) {
+    }
+}
+
+bool Checkpoint::load(IrredundantMatrix& irredundantMatrix)
+{
+    std::ifstream stream(_path, std::ios::binary);
+    if (!stream) {
+        return false;
+    }
+
+    char magic[CHECKPOINT_MAGIC_LEN];
+    std::string inputKey(CHECKPOINT_KEY_LEN, ' ');
+    uint32_t width, tasksCount;
+    uint64_t height;
+    stream.read(magic, CHECKPOINT_MAGIC_LEN);
+    stream.read(&inputKey[0], CHECKPOINT_KEY_LEN);
+    stream.read(reinterpret_cast<char*>(&width), sizeof(width));
+    stream.read(reinterpret_cast<char*>(&tasksCount), sizeof(tasksCount));
+    stream.read(reinterpret_cast<char*>(&height), sizeof(height));
+
+    if (!stream || memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0) {
+        throw std::runtime_error("Invalid checkpoint file " + _path);
+    }
+    if (inputKey != _inputKey || width != irredundantMatrix.getWidth() || tasksCount != _tasksCount) {
+        throw std::runtime_error("Checkpoint " + _path + " doesn't match input data");
+    }
+
+    std::vector<uint8_t> completed((tasksCount + 7) / 8);
+    std::vector<weight_t> r(width);
+    std::vector<int> rows(height * width);
+
+    stream.read(reinterpret_cast<char*>(completed.data()), completed.size());
+    stream.read(reinterpret_cast<char*>(r.data()), r.size() * sizeof(weight_t));
+    stream.read(reinterpret_cast<char*>(rows.data()), rows.size() * sizeof(int));
+    if (!stream) {
+        throw std::runtime_error("Checkpoint file " + _path + " is truncated");
+    }
+
+    for (auto i = 0; i < _tasksCount; ++i) {
+        _completed[i] = (completed[i / 8] >> (i % 8)) & 1;
+    }
+    irredundantMatrix.restore(rows, r);
+
+    DEBUG_INFO("Checkpoint: restored " << height << " rows");
+    return true;
+}
+
+void Checkpoint::start(IrredundantMatrix& irredundantMatrix)
+{
+    _irredundantMatrix = &irredundantMatrix;
+    _lastSnapshot = std::chrono::steady_clock::now();
+    _stopped = false;
+
+#ifdef MULTITHREAD
+    _writer = std::thread([this]() { writerLoop(); });
+#endif
+}
+
+void Checkpoint::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stopped) {
+            return;
+        }
+        _stopped = true;
+    }
+    _cv.notify_all();
+
+#ifdef MULTITHREAD
+    if (_writer.joinable()) {
+        _writer.join();
+    }
+#endif
+
+    if (_writerError) {
+        auto error = _writerError;
+        _writerError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+bool Checkpoint::isCompleted(int taskId)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _completed[taskId];
+}
+
+void Checkpoint::beginTask()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+#ifdef MULTITHREAD
+    START_COLLECT_TIME(crossThreading, Counters::CrossThreading);
+    _cv.wait(lock, [this]() { return !_pauseRequested; });
+    STOP_COLLECT_TIME(crossThreading);
+
+    _activeTasks += 1;
+#else
+    if (!_stopped && std::chrono::steady_clock::now() - _lastSnapshot >= _interval) {
+        takeSnapshot();
+        writeSnapshot();
+    }
+#endif
+}
+
+void Checkpoint::endTask(int taskId)
+{
+    endTask(std::vector<int>(1, taskId));
+}
+
+void Checkpoint::endTask(const std::vector<int>& taskIds)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (auto taskId : taskIds) {
+            _completed[taskId] = true;
+        }
+        IF_MULTITHREAD(_activeTasks -= 1);
+    }
+    _cv.notify_all();
+}
+
+void Checkpoint::takeSnapshot()
+{
+    _irredundantMatrix->snapshot(_snapshotRows, _snapshotR);
+    _snapshotCompleted = _completed;
+    _lastSnapshot = std::chrono::steady_clock::now();
+}
+
+void Checkpoint::writeSnapshot()
+{
+    uint32_t width = _snapshotR.size();
+    uint32_t tasksCount = _tasksCount;
+    uint64_t height = width > 0 ? _snapshotRows.size() / width : 0;
+
+    std::vector<uint8_t> completed((tasksCount + 7) / 8);
+    for (auto i = 0; i < _tasksCount; ++i) {
+        if (_snapshotCompleted[i]) {
+            completed[i / 8] |= 1 << (i % 8);
+        }
+    }
+
+    // Previous checkpoint is replaced only by completely written file
+    auto tempPath = _path + ".tmp";
+    {
+        std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+        stream.write(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+        stream.write(_inputKey.data(), CHECKPOINT_KEY_LEN);
+        stream.write(reinterpret_cast<const char*>(&width), sizeof(width));
+        stream.write(reinterpret_cast<const char*>(&tasksCount), sizeof(tasksCount));
+        stream.write(reinterpret_cast<const char*>(&height), sizeof(height));
+        stream.write(reinterpret_cast<const char*>(completed.data()), completed.size());
+        stream.write(reinterpret_cast<const char*>(_snapshotR.data()), _snapshotR.size() * sizeof(weight_t));
+        stream.write(reinterpret_cast<const char*>(_snapshotRows.data()), _snapshotRows.size() * sizeof(int));
+
+        if (!stream) {
+            throw std::runtime_error("Cannot write checkpoint file " + tempPath);
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), _path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace checkpoint file " + _path);
+    }
+
+    DEBUG_INFO("Checkpoint: saved " << height << " rows");
+}
+
+void Checkpoint::writerLoop()
+{
+    TimeCollector::ThreadInitialize();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        if (_cv.wait_for(lock, _interval, [this]() { return _stopped; })) {
+            break;
+        }
+
+        _pauseRequested = true;
+        _cv.wait(lock, [this]() { return _activeTasks == 0 || _stopped; });
+        if (_stopped) {
+            _pauseRequested = false;
+            break;
+        }
+
+        takeSnapshot();
+        _pauseRequested = false;
+
+        lock.unlock();
+        _cv.notify_all();
+
+        // Failed writer stops, previous checkpoint is kept and the error
+        // is rethrown by stop
+        try {
+            writeSnapshot();
+        } catch (...) {
+            _writerError = std::current_exception();
+            lock.lock();
+            break;
+        }
+        lock.lock();
+    }
+
+    lock.unlock();
+    _cv.notify_all();
+
+    TimeCollector::ThreadFinalize();
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef MULTITHREAD
+#include <thread>
+#endif
+
+#include "irredundant_matrix.hpp"
+
+// Periodically saves irredundant matrix, weights and ids of completed tasks.
+// Workers are paused only at task boundaries to take a copy of the state,
+// the copy is written by background thread
+class Checkpoint
+{
+
+public:
+    // Checkpoint is resumed only with the same input key, see UimCache::getKey
+    Checkpoint(const std::string& path, int interval, int tasksCount, const std::string& inputKey);
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    bool load(IrredundantMatrix& irredundantMatrix);
+    void start(IrredundantMatrix& irredundantMatrix);
+    void stop();
+
+    bool isCompleted(int taskId);
+    void beginTask();
+    void endTask(int taskId);
+    void endTask(const std::vector<int>& taskIds);
+
+private:
+    void takeSnapshot();
+    void writeSnapshot();
+    void writerLoop();
+
+private:
+    std::string _path;
+    std::chrono::seconds _interval;
+    int _tasksCount;
+    std::string _inputKey;
+
+    IrredundantMatrix* _irredundantMatrix;
+    std::vector<bool> _completed;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    int _activeTasks;
+    bool _pauseRequested;
+    bool _stopped;
+    std::chrono::steady_clock::time_point _lastSnapshot;
+
+    std::vector<int> _snapshotRows;
+    std::vector<weight_t> _snapshotR;
+    std::vector<bool> _snapshotCompleted;
+    std::exception_ptr _writerError;
+
+#ifdef MULTITHREAD
+    std::thread _writer;
+#endif
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,282 @@
+#include "chunked_matrix.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#ifdef MULTITHREAD
+#include <atomic>
+#include <thread>
+#endif
+
+#include "global_settings.h"
+#include "input_matrix.hpp"
+#include "timecollector.hpp"
+#include "workrow.hpp"
+
+const size_t MIN_MEMORY_LIMIT = 1048576;
+
+ChunkedMatrix::ChunkedMatrix(size_t memoryLimit, const std::string& tempDir)
+    : _memoryLimit(memoryLimit < MIN_MEMORY_LIMIT ? MIN_MEMORY_LIMIT : memoryLimit),
+      _tempDir(tempDir),
+      _qColsCount(0),
+      _rColsCount(0),
+      _workersCount(1),
+      _chunkRows(0),
+      _bufferRows(0),
+      _bufferedRows(0)
+{
+}
+
+ChunkedMatrix::~ChunkedMatrix()
+{
+    for (auto& file : _classFiles) {
+        std::remove(file.c_str());
+    }
+}
+
+void ChunkedMatrix::begin(set_size_t learningSetLen,
+                          feature_size_t featuresLen,
+                          feature_size_t pfeaturesLen)
+{
+    _qColsCount = featuresLen;
+    _rColsCount = pfeaturesLen;
+
+#ifdef MULTITHREAD
+    _workersCount = std::max(1u, std::thread::hardware_concurrency());
+#endif
+
+    // Every worker loads two chunks at the same time during calculation, the
+    // same amount of memory is used for write buffers during partitioning
+    size_t rowSize = _qColsCount * sizeof(int);
+    _chunkRows = std::min<size_t>(std::max<size_t>(1, _memoryLimit / (2 * rowSize * _workersCount)),
+                                  std::numeric_limits<int>::max() / (2 * _workersCount));
+    _bufferRows = _chunkRows * 2 * _workersCount;
+
+    _qMinimum.assign(_qColsCount, std::numeric_limits<feature_t>::max());
+    _qMaximum.assign(_qColsCount, std::numeric_limits<feature_t>::min());
+
+    DEBUG_INFO("ChunkedMatrix: " << learningSetLen << " rows, chunk " << _chunkRows << " rows");
+}
+
+void ChunkedMatrix::consume(const feature_t* features,
+                            const feature_t* pfeatures)
+{
+    START_COLLECT_TIME(preparingInput, Counters::PreparingInput);
+
+    std::vector<feature_t> image(pfeatures, pfeatures + _rColsCount);
+    auto classId = _classIds.find(image);
+    if (classId == _classIds.end()) {
+        std::stringstream name;
+        name << _tempDir << "/uim_chunk_" << getpid() << "_" << _classFiles.size() << ".bin";
+
+        classId = _classIds.insert({image, static_cast<int>(_classFiles.size())}).first;
+        _classFiles.push_back(name.str());
+        _classCounts.push_back(0);
+        _classBuffers.push_back(std::vector<int>());
+
+        std::ofstream(name.str(), std::ios::binary | std::ios::trunc);
+    }
+
+    auto& buffer = _classBuffers[classId->second];
+    for (auto j = 0; j < _qColsCount; ++j) {
+        buffer.push_back(features[j]);
+
+        if (features[j] != DataFile::DASH) {
+            _qMinimum[j] = std::min(_qMinimum[j], features[j]);
+            _qMaximum[j] = std::max(_qMaximum[j], features[j]);
+        }
+    }
+    _classCounts[classId->second] += 1;
+    _bufferedRows += 1;
+
+    if (_bufferedRows >= _bufferRows) {
+        flushBuffers();
+    }
+
+    STOP_COLLECT_TIME(preparingInput);
+}
+
+void ChunkedMatrix::end()
+{
+    flushBuffers();
+}
+
+void ChunkedMatrix::flushBuffers()
+{
+    for (size_t classId = 0; classId < _classBuffers.size(); ++classId) {
+        auto& buffer = _classBuffers[classId];
+        if (buffer.empty()) {
+            continue;
+        }
+
+        std::ofstream stream(_classFiles[classId], std::ios::binary | std::ios::app);
+        stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(int));
+        if (!stream) {
+            throw std::runtime_error("Cannot write chunk file " + _classFiles[classId]);
+        }
+
+        buffer.clear();
+        buffer.shrink_to_fit();
+    }
+
+    _bufferedRows = 0;
+}
+
+void ChunkedMatrix::readChunk(int classId, int offset, int length, int* chunk)
+{
+    std::ifstream stream(_classFiles[classId], std::ios::binary);
+    stream.seekg(static_cast<std::streamoff>(offset) * _qColsCount * sizeof(int));
+    stream.read(reinterpret_cast<char*>(chunk), static_cast<std::streamsize>(length) * _qColsCount * sizeof(int));
+    if (!stream) {
+        throw std::runtime_error("Cannot read chunk file " + _classFiles[classId]);
+    }
+}
+
+void ChunkedMatrix::calculate(IrredundantMatrix& irredundantMatrix, const DataFile& datafile)
+{
+    std::vector<int> qMinimum(_qMinimum.begin(), _qMinimum.end());
+    std::vector<int> qMaximum(_qMaximum.begin(), _qMaximum.end());
+    if (datafile.getRangesMin() != nullptr && datafile.getRangesMax() != nullptr) {
+        for (auto j = 0; j < _qColsCount; ++j) {
+            qMinimum[j] = datafile.getRangesMin()[j];
+            qMaximum[j] = datafile.getRangesMax()[j];
+        }
+    }
+
+    // Every task is a pair of chunks of different classes, tasks of the same
+    // first chunk go one after another, so a worker reads it only once
+    struct ChunkPair
+    {
+        int class1;
+        int offset1;
+        int class2;
+        int offset2;
+    };
+
+    std::vector<ChunkPair> tasks;
+    int classesCount = _classFiles.size();
+    for (auto class1 = 0; class1 < classesCount - 1; ++class1) {
+        for (auto offset1 = 0; offset1 < _classCounts[class1]; offset1 += _chunkRows) {
+            for (auto class2 = class1 + 1; class2 < classesCount; ++class2) {
+                for (auto offset2 = 0; offset2 < _classCounts[class2]; offset2 += _chunkRows) {
+                    tasks.push_back(ChunkPair{class1, offset1, class2, offset2});
+                }
+            }
+        }
+    }
+
+    auto processTasks = [this, &irredundantMatrix, &tasks, &qMinimum, &qMaximum](std::function<size_t()> nextTask)
+    {
+        #ifdef DIFFERENT_MATRICES
+        IrredundantMatrix matrixForThread(_qColsCount);
+        auto currentMatrix = &matrixForThread;
+        #else
+        auto currentMatrix = &irredundantMatrix;
+        #endif
+
+        std::vector<int> chunk1(static_cast<size_t>(_chunkRows) * _qColsCount);
+        std::vector<int> chunk2(static_cast<size_t>(_chunkRows) * _qColsCount);
+        auto loadedClass = -1;
+        auto loadedOffset = -1;
+
+        for (auto taskId = nextTask(); taskId < tasks.size(); taskId = nextTask()) {
+            auto& task = tasks[taskId];
+            auto length1 = std::min(_chunkRows, _classCounts[task.class1] - task.offset1);
+            auto length2 = std::min(_chunkRows, _classCounts[task.class2] - task.offset2);
+
+            DEBUG_INFO("ChunkedMatrix: " << task.class1 << "[" << task.offset1 << "] - "
+                       << task.class2 << "[" << task.offset2 << "]");
+
+            START_COLLECT_TIME(readingInput, Counters::ReadingInput);
+            if (task.class1 != loadedClass || task.offset1 != loadedOffset) {
+                readChunk(task.class1, task.offset1, length1, chunk1.data());
+                loadedClass = task.class1;
+                loadedOffset = task.offset1;
+            }
+            readChunk(task.class2, task.offset2, length2, chunk2.data());
+            STOP_COLLECT_TIME(readingInput);
+
+            #ifdef DIFFERENT_MATRICES
+            matrixForThread.clear();
+            #endif
+
+            processChunks(*currentMatrix,
+                          chunk1.data(), length1, chunk2.data(), length2,
+                          qMinimum.data(), qMaximum.data());
+
+            #ifdef DIFFERENT_MATRICES
+            irredundantMatrix.addMatrixConcurrent(std::move(matrixForThread));
+            #endif
+        }
+    };
+
+#ifdef MULTITHREAD
+    std::atomic<size_t> currentTask(0);
+    std::vector<std::thread> threads(_workersCount);
+    std::vector<std::exception_ptr> errors(_workersCount);
+
+    for (auto worker = 0; worker < _workersCount; ++worker) {
+        START_COLLECT_TIME(threading, Counters::Threading);
+        threads[worker] = std::thread([&processTasks, &currentTask, &tasks, &errors, worker]()
+        {
+            TimeCollector::ThreadInitialize();
+            try {
+                processTasks([&currentTask]() { return currentTask.fetch_add(1); });
+            } catch (...) {
+                // Other workers stop after their current tasks
+                errors[worker] = std::current_exception();
+                currentTask = tasks.size();
+            }
+            TimeCollector::ThreadFinalize();
+        });
+        STOP_COLLECT_TIME(threading);
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+#else
+    size_t currentTask = 0;
+    processTasks([&currentTask]() { return currentTask++; });
+#endif
+}
+
+void ChunkedMatrix::processChunks(IrredundantMatrix& irredundantMatrix,
+                                  int* chunk1, int length1, int* chunk2, int length2,
+                                  const int* qMinimum, const int* qMaximum)
+{
+    for(auto i=0; i<length1; ++i) {
+        for(auto j=0; j<length2; ++j) {
+            START_COLLECT_TIME(qHandling, Counters::QHandling);
+
+            WorkRow row1(chunk1, i, _qColsCount);
+            WorkRow row2(chunk2, j, _qColsCount);
+
+            auto diffRow = Row::createAsDifference(row1, row2);
+
+            weight_t r[_qColsCount];
+            InputMatrix::calcRVector(r, row1, row2, qMinimum, qMaximum);
+            STOP_COLLECT_TIME(qHandling);
+
+            #if defined(MULTITHREAD) && !defined(DIFFERENT_MATRICES)
+            irredundantMatrix.addRowConcurrent(std::move(diffRow), r);
+            #else
+            irredundantMatrix.addRow(std::move(diffRow), r);
+            #endif
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CHUNKEDMATRIX_H
+#define CHUNKEDMATRIX_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "datafile.hpp"
+#include "irredundant_matrix.hpp"
+
+// Out-of-core variant of InputMatrix: objects of learning set are partitioned
+// by class into files in temporary directory and class pairs are processed
+// chunk by chunk. Pairs of chunks are distributed between workers, every
+// worker keeps two chunks in memory, so chunks are smaller with more workers
+class ChunkedMatrix : public LearningSetConsumer
+{
+
+public:
+    ChunkedMatrix(size_t memoryLimit, const std::string& tempDir);
+    ~ChunkedMatrix();
+
+    ChunkedMatrix(const ChunkedMatrix&) = delete;
+    ChunkedMatrix& operator=(const ChunkedMatrix&) = delete;
+
+    void begin(set_size_t learningSetLen,
+               feature_size_t featuresLen,
+               feature_size_t pfeaturesLen) override;
+    void consume(const feature_t* features,
+                 const feature_t* pfeatures) override;
+    void end() override;
+
+    void calculate(IrredundantMatrix& irredundantMatrix, const DataFile& datafile);
+
+public:
+    inline int getFeatureWidth() const
+    {
+        return _qColsCount;
+    }
+
+private:
+    void flushBuffers();
+    void readChunk(int classId, int offset, int length, int* chunk);
+    void processChunks(IrredundantMatrix& irredundantMatrix,
+                       int* chunk1, int length1, int* chunk2, int length2,
+                       const int* qMinimum, const int* qMaximum);
+
+private:
+    size_t _memoryLimit;
+    std::string _tempDir;
+
+    int _qColsCount;
+    int _rColsCount;
+    int _workersCount;
+    int _chunkRows;
+    int _bufferRows;
+    int _bufferedRows;
+
+    std::vector<feature_t> _qMinimum;
+    std::vector<feature_t> _qMaximum;
+
+    std::map<std::vector<feature_t>, int> _classIds;
+    std::vector<std::string> _classFiles;
+    std::vector<int> _classCounts;
+    std::vector<std::vector<int>> _classBuffers;
+};
+
+#endif // CHUNKEDMATRIX_H
@@ -0,0 +1,300 @@
+#include "compressed_stream.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+const size_t GZIP_OUTPUT_SIZE = 1 << 20;
+
+bool isGzipData(const char* data, size_t size)
+{
+    return size >= 2 && static_cast<unsigned char>(data[0]) == 0x1f
+                     && static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+bool isGzipPath(const std::string& path)
+{
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+}
+
+#ifndef USE_ZLIB
+static void throwNoZlib()
+{
+    throw std::runtime_error("Compressed data is not supported, program is built without zlib");
+}
+#endif
+
+MemoryChunkReader::MemoryChunkReader(const char* begin, const char* end, size_t chunkSize)
+    : _current(begin), _end(end), _chunkSize(chunkSize)
+{
+}
+
+bool MemoryChunkReader::read(std::vector<char>& buffer)
+{
+    if (_current == _end) {
+        return false;
+    }
+
+    auto size = std::min<size_t>(_chunkSize, _end - _current);
+    buffer.insert(buffer.end(), _current, _current + size);
+    _current += size;
+    return true;
+}
+
+StreamChunkReader::StreamChunkReader(std::istream& inputStream, size_t chunkSize)
+    : _inputStream(inputStream), _chunkSize(chunkSize)
+{
+}
+
+bool StreamChunkReader::read(std::vector<char>& buffer)
+{
+    auto size = buffer.size();
+    buffer.resize(size + _chunkSize);
+    _inputStream.read(buffer.data() + size, _chunkSize);
+    buffer.resize(size + _inputStream.gcount());
+
+    return buffer.size() > size;
+}
+
+GzipChunkReader::GzipChunkReader(ChunkReader& source, size_t chunkSize)
+    : _source(source), _chunkSize(chunkSize), _sourceFinished(false), _finished(false)
+{
+#ifdef USE_ZLIB
+    _stream.zalloc = Z_NULL;
+    _stream.zfree = Z_NULL;
+    _stream.opaque = Z_NULL;
+    _stream.next_in = Z_NULL;
+    _stream.avail_in = 0;
+
+    // Window bits 15 + 16 accept gzip header only
+    if (inflateInit2(&_stream, 15 + 16) != Z_OK) {
+        throw std::runtime_error("Cannot initialize gzip decompression");
+    }
+#else
+    throwNoZlib();
+#endif
+}
+
+GzipChunkReader::~GzipChunkReader()
+{
+#ifdef USE_ZLIB
+    inflateEnd(&_stream);
+#endif
+}
+
+bool GzipChunkReader::read(std::vector<char>& buffer)
+{
+#ifdef USE_ZLIB
+    auto size = buffer.size();
+    buffer.resize(size + _chunkSize);
+
+    _stream.next_out = reinterpret_cast<Bytef*>(buffer.data() + size);
+    _stream.avail_out = _chunkSize;
+
+    while (_stream.avail_out > 0 && !_finished) {
+        if (_stream.avail_in == 0) {
+            _input.clear();
+            if (!_sourceFinished && !_source.read(_input)) {
+                _sourceFinished = true;
+            }
+            _stream.next_in = reinterpret_cast<Bytef*>(_input.data());
+            _stream.avail_in = _input.size();
+        }
+
+        auto result = inflate(&_stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+            // Next member of concatenated gzip data follows
+            if (_stream.avail_in == 0) {
+                _input.clear();
+                if (!_sourceFinished && !_source.read(_input)) {
+                    _sourceFinished = true;
+                }
+                _stream.next_in = reinterpret_cast<Bytef*>(_input.data());
+                _stream.avail_in = _input.size();
+            }
+            if (_stream.avail_in == 0) {
+                _finished = true;
+            } else {
+                inflateReset(&_stream);
+            }
+        } else if (result == Z_BUF_ERROR && _sourceFinished) {
+            throw std::runtime_error("Cannot decompress input, gzip data is truncated");
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            throw std::runtime_error("Cannot decompress input, gzip data is broken");
+        }
+    }
+
+    buffer.resize(buffer.size() - _stream.avail_out);
+    return buffer.size() > size;
+#else
+    return false;
+#endif
+}
+
+#ifdef MULTITHREAD
+ThreadedChunkReader::ThreadedChunkReader(ChunkReader& source, size_t queueLength)
+    : _source(source),
+      _queueLength(queueLength),
+      _finished(false),
+      _stopped(false)
+{
+    _reader = std::thread([this]() { readerLoop(); });
+}
+
+ThreadedChunkReader::~ThreadedChunkReader()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stopped = true;
+    }
+    _cv.notify_all();
+
+    if (_reader.joinable()) {
+        _reader.join();
+    }
+}
+
+bool ThreadedChunkReader::read(std::vector<char>& buffer)
+{
+    std::vector<char> chunk;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() { return !_queue.empty() || _finished; });
+
+        if (_queue.empty()) {
+            if (_error) {
+                std::rethrow_exception(_error);
+            }
+            return false;
+        }
+
+        chunk = std::move(_queue.front());
+        _queue.pop_front();
+    }
+    _cv.notify_all();
+
+    buffer.insert(buffer.end(), chunk.begin(), chunk.end());
+    return true;
+}
+
+void ThreadedChunkReader::readerLoop()
+{
+    try {
+        for (;;) {
+            std::vector<char> chunk;
+            if (!_source.read(chunk)) {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _queue.size() < _queueLength || _stopped; });
+            if (_stopped) {
+                return;
+            }
+            _queue.push_back(std::move(chunk));
+            lock.unlock();
+            _cv.notify_all();
+        }
+    } catch (...) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _error = std::current_exception();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished = true;
+    }
+    _cv.notify_all();
+}
+#endif
+
+GzipOutputStream::GzipOutputStream(std::ostream& outputStream)
+    : std::ostream(nullptr), _buffer(outputStream)
+{
+    rdbuf(&_buffer);
+}
+
+GzipOutputStream::~GzipOutputStream()
+{
+    finish();
+}
+
+void GzipOutputStream::finish()
+{
+    flush();
+    _buffer.finish();
+}
+
+GzipOutputStream::Buffer::Buffer(std::ostream& outputStream)
+    : _outputStream(outputStream), _output(GZIP_OUTPUT_SIZE), _finished(false)
+{
+#ifdef USE_ZLIB
+    _stream.zalloc = Z_NULL;
+    _stream.zfree = Z_NULL;
+    _stream.opaque = Z_NULL;
+
+    // Text of data files compresses well enough with the fastest level
+    if (deflateInit2(&_stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Cannot initialize gzip compression");
+    }
+#else
+    throwNoZlib();
+#endif
+}
+
+GzipOutputStream::Buffer::~Buffer()
+{
+#ifdef USE_ZLIB
+    deflateEnd(&_stream);
+#endif
+}
+
+void GzipOutputStream::Buffer::finish()
+{
+    if (!_finished) {
+        _finished = true;
+#ifdef USE_ZLIB
+        deflateData(nullptr, 0, true);
+#endif
+        _outputStream.flush();
+    }
+}
+
+int GzipOutputStream::Buffer::overflow(int c)
+{
+    if (c != traits_type::eof()) {
+        auto value = static_cast<char>(c);
+        deflateData(&value, 1, false);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize GzipOutputStream::Buffer::xsputn(const char* data, std::streamsize size)
+{
+    deflateData(data, size, false);
+    return size;
+}
+
+int GzipOutputStream::Buffer::sync()
+{
+    _outputStream.flush();
+    return _outputStream ? 0 : -1;
+}
+
+void GzipOutputStream::Buffer::deflateData(const char* data, size_t size, bool finish)
+{
+#ifdef USE_ZLIB
+    if (_finished && !finish) {
+        throw std::runtime_error("Cannot write to finished gzip stream");
+    }
+
+    _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    _stream.avail_in = size;
+
+    do {
+        _stream.next_out = reinterpret_cast<Bytef*>(_output.data());
+        _stream.avail_out = _output.size();
+        deflate(&_stream, finish ? Z_FINISH : Z_NO_FLUSH);
+        _outputStream.write(_output.data(), _output.size() - _stream.avail_out);
+    } while (_stream.avail_out == 0 || _stream.avail_in > 0);
+#endif
+}
@@ -0,0 +1,162 @@
+#ifndef COMPRESSED_STREAM_H
+#define COMPRESSED_STREAM_H
+
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef MULTITHREAD
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+bool isGzipData(const char* data, size_t size);
+bool isGzipPath(const std::string& path);
+
+// Source of input data read by chunks
+class ChunkReader
+{
+public:
+    virtual ~ChunkReader() {}
+
+    // Appends the next chunk to the buffer, returns false at the end of data
+    virtual bool read(std::vector<char>& buffer) = 0;
+};
+
+class MemoryChunkReader : public ChunkReader
+{
+public:
+    MemoryChunkReader(const char* begin, const char* end, size_t chunkSize);
+
+    bool read(std::vector<char>& buffer) override;
+
+private:
+    const char* _current;
+    const char* _end;
+    size_t _chunkSize;
+};
+
+class StreamChunkReader : public ChunkReader
+{
+public:
+    StreamChunkReader(std::istream& inputStream, size_t chunkSize);
+
+    bool read(std::vector<char>& buffer) override;
+
+private:
+    std::istream& _inputStream;
+    size_t _chunkSize;
+};
+
+// Inflates gzip data of the source, concatenated members are inflated one
+// after another as gzip tool does
+class GzipChunkReader : public ChunkReader
+{
+public:
+    GzipChunkReader(ChunkReader& source, size_t chunkSize);
+    ~GzipChunkReader();
+
+    GzipChunkReader(const GzipChunkReader&) = delete;
+    GzipChunkReader& operator=(const GzipChunkReader&) = delete;
+
+    bool read(std::vector<char>& buffer) override;
+
+private:
+    ChunkReader& _source;
+    size_t _chunkSize;
+    std::vector<char> _input;
+    bool _sourceFinished;
+    bool _finished;
+
+#ifdef USE_ZLIB
+    z_stream _stream;
+#endif
+};
+
+#ifdef MULTITHREAD
+// Reads chunks of the source by background thread, so that reading and
+// decompression overlap with processing of previous chunks. Amount of
+// chunks read ahead is limited by queue length
+class ThreadedChunkReader : public ChunkReader
+{
+public:
+    ThreadedChunkReader(ChunkReader& source, size_t queueLength);
+    ~ThreadedChunkReader();
+
+    ThreadedChunkReader(const ThreadedChunkReader&) = delete;
+    ThreadedChunkReader& operator=(const ThreadedChunkReader&) = delete;
+
+    bool read(std::vector<char>& buffer) override;
+
+private:
+    void readerLoop();
+
+private:
+    ChunkReader& _source;
+    size_t _queueLength;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::vector<char>> _queue;
+    bool _finished;
+    bool _stopped;
+    std::exception_ptr _error;
+
+    std::thread _reader;
+};
+#endif
+
+// Output stream which compresses written data to gzip format
+class GzipOutputStream : public std::ostream
+{
+public:
+    explicit GzipOutputStream(std::ostream& outputStream);
+    ~GzipOutputStream();
+
+    // Writes gzip trailer, the stream can't be used after that
+    void finish();
+
+private:
+    class Buffer : public std::streambuf
+    {
+    public:
+        explicit Buffer(std::ostream& outputStream);
+        ~Buffer();
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        void finish();
+
+    protected:
+        int overflow(int c) override;
+        std::streamsize xsputn(const char* data, std::streamsize size) override;
+        int sync() override;
+
+    private:
+        void deflateData(const char* data, size_t size, bool finish);
+
+    private:
+        std::ostream& _outputStream;
+        std::vector<char> _output;
+        bool _finished;
+
+#ifdef USE_ZLIB
+        z_stream _stream;
+#endif
+    };
+
+    Buffer _buffer;
+};
+
+#endif // COMPRESSED_STREAM_H
@@ -0,0 +1,231 @@
+#ifndef COVER_BITSETS_H
+#define COVER_BITSETS_H
+
+#include <algorithm>
+#include <vector>
+
+#include "global_settings.h"
+
+typedef uint64_t row_word_t;
+const int row_word_bits = std::numeric_limits<row_word_t>::digits;
+const row_word_t row_word_full = ~static_cast<row_word_t>(0);
+
+// Binarized uim stored by columns, every column is a bitset over rows.
+// Coverage counters of rows are bit-sliced: one word keeps the same bit of
+// counters of 64 rows, so adding a column to 64 counters takes a few word
+// operations. Counters stop at needCover, saturated rows are marked
+// separately and padding rows of the last word are saturated from the start.
+// State of coverage keeps for every word of rows the saturated mask
+// followed by planes of counters
+class CoverBitsets final {
+
+public:
+    CoverBitsets(const test_feature_t* uim,
+                 set_size_t uimSetLen,
+                 feature_size_t featuresLen,
+                 feature_size_t needCover,
+                 const feature_size_t* currentCover) :
+        _wordsLen((uimSetLen + row_word_bits - 1) / row_word_bits),
+        _needCover(needCover),
+        _planesLen(0)
+    {
+        while ((static_cast<uint64_t>(1) << _planesLen) <= needCover) {
+            _planesLen += 1;
+        }
+
+        // Rows with the least spare columns reject most of candidates, they
+        // are placed to the first words, which are checked first
+        std::vector<set_size_t> order(uimSetLen);
+        std::vector<feature_size_t> spare(uimSetLen, 0);
+        for (set_size_t r = 0; r < uimSetLen; ++r) {
+            order[r] = r;
+            for (feature_size_t j = 0; j < featuresLen; ++j) {
+                spare[r] += uim[static_cast<size_t>(r) * featuresLen + j] ? 1 : 0;
+            }
+            spare[r] += currentCover[r];
+        }
+        std::stable_sort(order.begin(), order.end(), [&spare](set_size_t first, set_size_t second) {
+            return spare[first] < spare[second];
+        });
+
+        _columns.assign(static_cast<size_t>(featuresLen) * _wordsLen, 0);
+        _initial.assign(getStateLen(), 0);
+
+        for (set_size_t i = 0; i < _wordsLen * row_word_bits; ++i) {
+            auto word = i / row_word_bits;
+            auto bit = static_cast<row_word_t>(1) << (i % row_word_bits);
+            auto state = &_initial[static_cast<size_t>(word) * (_planesLen + 1)];
+
+            if (i >= uimSetLen || currentCover[order[i]] >= needCover) {
+                state[0] |= bit;
+                continue;
+            }
+
+            auto r = order[i];
+            for (feature_size_t b = 0; b < _planesLen; ++b) {
+                if ((currentCover[r] >> b) & 1) {
+                    state[b + 1] |= bit;
+                }
+            }
+
+            for (feature_size_t j = 0; j < featuresLen; ++j) {
+                if (uim[static_cast<size_t>(r) * featuresLen + j]) {
+                    _columns[static_cast<size_t>(j) * _wordsLen + word] |= bit;
+                }
+            }
+        }
+    }
+
+    inline set_size_t getWordsLen() const { return _wordsLen; }
+    inline size_t getStateLen() const { return static_cast<size_t>(_wordsLen) * (_planesLen + 1); }
+    inline const row_word_t* getInitial() const { return _initial.data(); }
+    inline const row_word_t* getColumn(feature_size_t column) const {
+        return &_columns[static_cast<size_t>(column) * _wordsLen];
+    }
+
+    inline size_t getStride() const { return _planesLen + 1; }
+
+    // Adds word of column to the word of state
+    inline void addWord(const row_word_t* state, row_word_t values, row_word_t* outState) const {
+        if (_needCover == 1) {
+            outState[0] = state[0] | values;
+            return;
+        }
+
+        auto carry = values & ~state[0];
+        auto reached = row_word_full;
+        for (feature_size_t b = 0; b < _planesLen; ++b) {
+            auto plane = state[b + 1] ^ carry;
+            carry &= state[b + 1];
+            outState[b + 1] = plane;
+            reached &= ((_needCover >> b) & 1) ? plane : ~plane;
+        }
+        outState[0] = state[0] | reached;
+    }
+
+    // Checks whether every row of the word of state with one more column
+    // is covered needCover times
+    inline bool isCoveredWord(const row_word_t* state, row_word_t values) const {
+        if (_needCover == 1) {
+            return (state[0] | values) == row_word_full;
+        }
+
+        row_word_t planes[std::numeric_limits<feature_size_t>::digits + 1];
+        addWord(state, values, planes);
+        return planes[0] == row_word_full;
+    }
+
+private:
+    set_size_t _wordsLen;
+    feature_size_t _needCover;
+    feature_size_t _planesLen;
+
+    // featuresLen bitsets of wordsLen words
+    std::vector<row_word_t> _columns;
+    // state without any column
+    std::vector<row_word_t> _initial;
+};
+
+// Coverage of rows by upper columns of the current combination, kept for
+// every position. Successive combinations share upper columns, so after a
+// step of enumeration only states of changed positions are recounted and
+// the candidate is checked against a single state and its lowest column.
+// States are recounted lazily up to the word which is checked, because
+// most candidates are rejected by the first words. Words which reject
+// candidates are counted, and words are periodically reordered so that
+// the most frequent rejectors of this worker are checked first
+class CoverStack final {
+
+public:
+    CoverStack(const CoverBitsets& bitsets) :
+        _bitsets(bitsets),
+        _order(bitsets.getWordsLen()),
+        _rejects(bitsets.getWordsLen(), 0),
+        _checksLen(0),
+        _columnsLen(0)
+    {
+        for (set_size_t w = 0; w < bitsets.getWordsLen(); ++w) {
+            _order[w] = w;
+        }
+    }
+
+    // Positions below changedLen differ from the previous call
+    inline bool isCovered(const feature_size_t* columns, feature_size_t columnsLen, feature_size_t changedLen) {
+        auto stateLen = _bitsets.getStateLen();
+        auto stride = _bitsets.getStride();
+        auto wordsLen = _bitsets.getWordsLen();
+
+        if (columnsLen != _columnsLen) {
+            _columnsLen = columnsLen;
+            _states.resize((columnsLen + 1) * stateLen);
+            _validWords.resize(columnsLen + 1);
+            std::copy(_bitsets.getInitial(), _bitsets.getInitial() + stateLen, &_states[columnsLen * stateLen]);
+            _validWords[columnsLen] = wordsLen;
+            changedLen = columnsLen;
+        }
+
+        if (++_checksLen == REORDER_PERIOD) {
+            reorder();
+            changedLen = columnsLen;
+        }
+
+        // State of position p is coverage by columns from p to the last
+        // one, the valid words of states don't decrease with position
+        for (feature_size_t p = 1; p < std::min(changedLen, columnsLen); ++p) {
+            _validWords[p] = 0;
+        }
+
+        auto lowest = _bitsets.getColumn(columns[0]);
+        for (set_size_t i = 0; i < wordsLen; ++i) {
+            auto w = _order[i];
+            if (i >= _validWords[1]) {
+                auto top = 2;
+                while (_validWords[top] <= i) {
+                    top += 1;
+                }
+                for (auto p = top - 1; p >= 1; --p) {
+                    _bitsets.addWord(&_states[p * stateLen + w * stride + stateLen],
+                                     _bitsets.getColumn(columns[p])[w],
+                                     &_states[p * stateLen + w * stride]);
+                    _validWords[p] = i + 1;
+                }
+            }
+
+            if (!_bitsets.isCoveredWord(&_states[stateLen + w * stride], lowest[w])) {
+                _rejects[w] += 1;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static const uint32_t REORDER_PERIOD = 1 << 16;
+
+    // Counts are halved, so the order follows the latest candidates
+    void reorder() {
+        _checksLen = 0;
+        std::stable_sort(_order.begin(), _order.end(), [this](set_size_t first, set_size_t second) {
+            return _rejects[first] > _rejects[second];
+        });
+        for (auto& rejects : _rejects) {
+            rejects /= 2;
+        }
+    }
+
+private:
+    const CoverBitsets& _bitsets;
+    std::vector<row_word_t> _states;
+    // Amount of leading words in order of checking which are counted
+    // for every state
+    std::vector<set_size_t> _validWords;
+
+    std::vector<set_size_t> _order;
+    std::vector<uint32_t> _rejects;
+    uint32_t _checksLen;
+
+    feature_size_t _columnsLen;
+};
+
+#endif // COVER_BITSETS_H
@@ -1,14 +1,17 @@
 #include <argparse.h>
 
 #include <algorithm>
+#include <vector>
 
 #ifdef MULTITHREAD
 #include <thread>
 #endif
 
 #include "global_settings.h"
+#include "cover_bitsets.hpp"
 #include "cover_common.hpp"
 #include "cover_generator.hpp"
+#include "covering_filter.hpp"
 #include "resultset.hpp"
 #include "timecollector.hpp"
 
@@ -17,52 +20,42 @@ const set_size_t DEFAULT_WORK_BLOCK = 1024;
 class Context final {
 
 public:
-    Context(test_feature_t* uimSet,
-            set_size_t uimSetLen,
+    Context(const CoverBitsets& bitsets,
             feature_size_t featuresLen,
             ResultSet& resultSet,
+            CoveringFilter& foundCoverings,
             set_size_t limit,
-            feature_size_t cover,
-            feature_size_t* currentCover,
             CoverGenerator& generator,
             set_size_t workBlock) :
-        _uimSet(uimSet),
-        _uimSetLen(uimSetLen),
+        _bitsets(bitsets),
         _featuresLen(featuresLen),
         _resultSet(resultSet),
+        _foundCoverings(foundCoverings),
         _limit(limit),
-        _cover(cover),
-        _currentCover(currentCover),
         _generator(generator),
         _workBlock(workBlock) { }
 
-    inline test_feature_t* getUimSet() const { return _uimSet; }
-    inline set_size_t getUimSetLen() const { return _uimSetLen; }
+    inline const CoverBitsets& getBitsets() const { return _bitsets; }
     inline feature_size_t getFeaturesLen() const { return _featuresLen; }
     inline ResultSet& getResultSet() const { return _resultSet; }
+    inline CoveringFilter& getFoundCoverings() const { return _foundCoverings; }
     inline set_size_t getLimit() const { return _limit; }
-    inline feature_size_t getCover() const { return _cover; }
-    inline feature_size_t* getCurrentCover() const { return _currentCover; }
     inline CoverGenerator& getGenerator() const { return _generator; }
     inline set_size_t getWorkBlock() const { return _workBlock; }
 
 #ifdef MULTITHREAD
-    inline std::mutex& getGeneratorLock() { return _generatorLock; }
     inline std::mutex& getResultsLock() { return _resultsLock; }
 #endif
 
 private:
-    test_feature_t* _uimSet;
-    set_size_t _uimSetLen;
+    const CoverBitsets& _bitsets;
     feature_size_t _featuresLen;
     ResultSet& _resultSet;
+    CoveringFilter& _foundCoverings;
     set_size_t _limit;
-    feature_size_t _cover;
-    feature_size_t* _currentCover;
     CoverGenerator& _generator;
     set_size_t _workBlock;
 #ifdef MULTITHREAD
-    std::mutex _generatorLock;
     std::mutex _resultsLock;
 #endif
 };
@@ -93,11 +86,12 @@ void findCovering(feature_t* uim,
                   set_size_t limit,
                   feature_size_t needCover) {
 
-    test_feature_t nuim[uimSetLen * featuresLen];
+    std::vector<test_feature_t> nuimBuffer(static_cast<size_t>(uimSetLen) * featuresLen);
+    auto nuim = nuimBuffer.data();
     CoverCommon::binarize(uim, uimSetLen, featuresLen, nuim);
 
-    feature_size_t currentCover[uimSetLen];
-    std::fill(&currentCover[0], &currentCover[uimSetLen], 0);
+    std::vector<feature_size_t> currentCoverBuffer(uimSetLen, 0);
+    auto currentCover = currentCoverBuffer.data();
 
 #ifdef PREPARE_DATA
     auto origFeaturesLen = featuresLen;
@@ -141,14 +135,16 @@ void findCovering(feature_t* uim,
     ResultSet& tempResultSet = resultSet;
 #endif
 
+    CoverBitsets bitsets(nuim, uimSetLen, featuresLen, needCover, currentCover);
+
+    CoveringFilter foundCoverings(featuresLen);
+
     CoverGenerator generator(featuresLen);
-    Context context(nuim,
-                    uimSetLen,
+    Context context(bitsets,
                     featuresLen,
                     tempResultSet,
+                    foundCoverings,
                     limit,
-                    needCover,
-                    currentCover,
                     generator,
                     parser_int_get_value(work_block_arg));
 
@@ -197,57 +193,56 @@ void findCovering(feature_t* uim,
 }
 
 void breadthWorker(Context& context) {
-    uint_fast32_t _count;
-    uint_fast8_t _tasks[context.getFeaturesLen() * context.getWorkBlock()];
-    bool coverAll;
-    bool workIsEnd;
-    uint_fast16_t coverKoef;
+    CoverGenerator::Cursor cursor(context.getGenerator());
+    CoverStack stack(context.getBitsets());
+    CoveringFilter foundCoverings(context.getFeaturesLen());
+    feature_size_t stackChangedLen = 0;
+    test_feature_t covering[context.getFeaturesLen()];
+    bool covered;
+    cover_rank_t first;
+    cover_rank_t last;
 
     for(;;) {
-        workIsEnd = false;
-
         IF_MULTITHREAD(context.getResultsLock().lock());
-        if (context.getResultSet().isFull()) {
-            workIsEnd = true;
-        }
+        foundCoverings.update(context.getFoundCoverings());
         IF_MULTITHREAD(context.getResultsLock().unlock());
 
-        if (workIsEnd) {
-            return;
-        }
-
-        IF_MULTITHREAD(context.getGeneratorLock().lock());
-        _count = context.getGenerator().next(_tasks, context.getWorkBlock());
-        IF_MULTITHREAD(context.getGeneratorLock().unlock());
-
-        if (_count == 0) {
+        if (!context.getGenerator().claim(context.getWorkBlock(), first, last)) {
             return;
         }
 
-        for(uint_fast32_t i=0; i<_count; ++i) {
-            coverAll = true;
+        cursor.seek(first);
+        for(auto rank=first; rank<last; ++rank, cursor.next()) {
+            // Generation is cut by other workers as soon as results are
+            // complete, the rest of the block isn't needed then
+            if (rank >= context.getGenerator().getEndRank()) {
+                break;
+            }
 
-            for (uint_fast32_t r=0; r<context.getUimSetLen(); ++r) {
-                coverKoef = context.getCurrentCover()[r];;
+            // Supersets of found coverings are skipped, they can't be
+            // irreducible. Stack isn't updated for them, so changes of
+            // positions are gathered until the next check
+            stackChangedLen = std::max(stackChangedLen, cursor.getChangedLen());
+            if (foundCoverings.contains(cursor.getColumns(), cursor.getColumnsLen(), cursor.getChangedLen())) {
+                continue;
+            }
 
-                for(uint_fast16_t j=0; j<context.getFeaturesLen(); ++j) {
-                    if (_tasks[i * context.getFeaturesLen() + j] && context.getUimSet()[r * context.getFeaturesLen() + j]) {
-                        coverKoef += 1;
-                        if (coverKoef == context.getCover()) {
-                            break;
-                        }
-                    }
-                }
+            covered = stack.isCovered(cursor.getColumns(), cursor.getColumnsLen(), stackChangedLen);
+            stackChangedLen = 0;
 
-                if (coverKoef < context.getCover()) {
-                    coverAll = false;
-                    break;
-                }
-            }
+            if (covered) {
+                cursor.fill(covering);
 
-            if (coverAll) {
                 IF_MULTITHREAD(context.getResultsLock().lock());
-                context.getResultSet().append(&_tasks[i * context.getFeaturesLen()]);
+                context.getResultSet().append(covering);
+                context.getFoundCoverings().append(cursor.getColumns(), cursor.getColumnsLen());
+
+                // Candidates which cost as much as the most expensive result
+                // of full set can't be appended, all of them are generated
+                // after cheaper ones, so generation stops at that size
+                if (context.getResultSet().isFull()) {
+                    context.getGenerator().limitSize(context.getResultSet().getCostBarrier());
+                }
                 IF_MULTITHREAD(context.getResultsLock().unlock());
             }
         }
@@ -10,7 +10,7 @@ void CoverCommon::binarize(feature_t* uim,
                            feature_size_t featuresLen,
                            test_feature_t* newUim) {
 
-    for (auto i=0; i<uimSetLen; ++i) {
+    for (size_t i=0; i<uimSetLen; ++i) {
         for (auto j=0; j<featuresLen; ++j) {
             newUim[i*featuresLen+j] = !!uim[i*featuresLen+j];
         }
@@ -37,7 +37,7 @@ void CoverCommon::calcPriorities(test_feature_t* uim,
     std::fill(&markedColumns[0], &markedColumns[featuresLen], false);
     std::fill(&weights[0], &weights[featuresLen], false);
 
-    for (auto i=0; i<uimSetLen; ++i) {
+    for (size_t i=0; i<uimSetLen; ++i) {
         feature_size_t count = 0;
         for (auto j=0; j<featuresLen; ++j) {
             count += uim[i * featuresLen + j];
@@ -124,7 +124,7 @@ void CoverCommon::reduceUim(test_feature_t* uim,
     }
 
     newUimSetLen = 0;
-    for (auto i=0; i<uimSetLen; ++i) {
+    for (size_t i=0; i<uimSetLen; ++i) {
         feature_size_t count = 0;
         for (auto j = 0; j < columnsLen; ++j) {
             count += uim[i * featuresLen + columns[j]];
@@ -142,7 +142,7 @@ void CoverCommon::reduceUim(test_feature_t* uim,
                     continue;
                 }
 
-                newUim[newFeaturesLen * newUimSetLen + (cj++)] = uim[i * featuresLen + j];
+                newUim[static_cast<size_t>(newUimSetLen) * newFeaturesLen + (cj++)] = uim[i * featuresLen + j];
             }
 
             newUimSetLen += 1;
@@ -178,7 +178,7 @@ void CoverCommon::reorderUim(test_feature_t* uim,
 
     newUimSetLen = uimSetLen;
     feature_t tempUimRow[orderLen];
-    for (auto i=0; i<uimSetLen; ++i) {
+    for (size_t i=0; i<uimSetLen; ++i) {
         for (auto j=0; j<orderLen; ++j) {
             tempUimRow[j] = uim[i * featuresLen + order[j]];
         }
@@ -206,7 +206,7 @@ void CoverCommon::debugPrintUim(test_feature_t* uim,
          }
          getDebugStream() << std::endl;
 
-         for (auto i=0; i<uimSetLen; ++i) {
+         for (size_t i=0; i<uimSetLen; ++i) {
              for (auto j=0; j<featuresLen; ++j) {
                  getDebugStream() << std::setw(3) << (uim[i* featuresLen + j] ? 1 : 0);
              }
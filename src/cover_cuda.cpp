@@ -1,5 +1,8 @@
 #include <argparse.h>
 
+#include <algorithm>
+#include <stdexcept>
+
 #include "global_settings.h"
 #include "cover_cuda.h"
 #include "cover_generator.hpp"
@@ -8,6 +11,8 @@
 
 const set_size_t DEFAULT_WORK_BLOCK = 1024;
 const set_size_t DEFAULT_THREADS = 128;
+// Rows are reordered by rejections after this amount of blocks
+const set_size_t REORDER_PERIOD = 16;
 
 parser_int_arg_t* work_block_arg;
 parser_int_arg_t* thread_block_arg;
@@ -29,38 +34,50 @@ void findCovering(feature_t* uim,
                   set_size_t uimSetLen,
                   feature_size_t featuresLen,
                   ResultSet& resultSet,
-                  int limit,
-                  int cover) {
+                  set_size_t limit,
+                  feature_size_t needCover) {
 
     CoverGenerator generator(featuresLen);
 
     set_size_t workBlock = parser_int_get_value(work_block_arg);
     set_size_t threadBlock = parser_int_get_value(thread_block_arg);
     uint_fast32_t _count;
+    set_size_t blocksCount = 0;
 
     cudacover_t* ctx;
-    cudacover_init(&ctx, uimSetLen, featuresLen, workBlock);
-    for (auto i=0; i<uimSetLen; ++i) {
-        for (auto j=0; j<featuresLen; ++j) {
-            ctx->lset[i * featuresLen + j] = uim[i * featuresLen + j];
-        }
+    if (cudacover_init(&ctx, uimSetLen, featuresLen, workBlock) != CUDA_COVER_RESULT_OK) {
+        throw std::runtime_error("Can't initialize coverage checking context");
     }
-    ctx->cover_koef = cover;
 
-    for(;;) {
-        if (resultSet.isFull()) {
-            return;
+    for (size_t i=0; i<uimSetLen; ++i) {
+        for (size_t j=0; j<featuresLen; ++j) {
+            ctx->lset[i * featuresLen + j] = uim[i * featuresLen + j] ? 1 : 0;
         }
+    }
+    ctx->cover_koef = needCover;
 
-        if ((_count = generator.next((unsigned char*)ctx->block, workBlock)) == 0) {
-            return;
+    for(;;) {
+        if ((_count = generator.next(reinterpret_cast<test_feature_t*>(ctx->block), workBlock)) == 0) {
+            break;
         }
 
+        ctx->results_counter = 0;
         cudacover_check(ctx, _count, threadBlock);
+        if (++blocksCount % REORDER_PERIOD == 0) {
+            cudacover_reorder(ctx);
+        }
 
+        // Results may be reported in any order, they are appended in order
+        // of generation, so the first found covering wins among equal ones
+        std::sort(&ctx->results[0], &ctx->results[ctx->results_counter]);
         for (int i = 0; i < ctx->results_counter; ++i) {
-            Result result = Result((unsigned char*)&ctx->block[ctx->results[i] * featuresLen], featuresLen);
-            resultSet.append(std::move(result));
+            resultSet.append(reinterpret_cast<test_feature_t*>(&ctx->block[static_cast<size_t>(ctx->results[i]) * featuresLen]));
+
+            // Candidates which cost as much as the most expensive result of
+            // full set can't be appended, generation stops at that size
+            if (resultSet.isFull()) {
+                generator.limitSize(resultSet.getCostBarrier());
+            }
         }
     }
 
@@ -1,8 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cover_cuda.h"
 
 __global__
-void kernel(int cover_koef, int features, char *lset, int lset_len, char *block, int block_len, int *results, int *results_counter)
+void kernel(int cover_koef, int features, char *lset, int lset_len, char *block, int block_len, int *results, int *results_counter, int *rejects)
 {
     int index = blockIdx.x*blockDim.x + threadIdx.x;
 
@@ -19,6 +21,7 @@ void kernel(int cover_koef, int features, char *lset, int lset_len, char *block,
             }
 
             if (cover < cover_koef) {
+                atomicAdd(&rejects[i], 1);
                 coverAll = false;
                 break;
             }
@@ -47,11 +50,14 @@ cudacover_result_t cudacover_init(cudacover_t** ctx,
     temp->block = (char*)malloc(block_len * features * sizeof(char));
     temp->results = (int*)malloc(block_len * sizeof(int));
     temp->results_counter = 0;
+    temp->rejects = (int*)malloc(lset_len * sizeof(int));
 
     cudaMalloc(&temp->__lset, lset_len * features * sizeof(char));
     cudaMalloc(&temp->__block, block_len * features * sizeof(char));
     cudaMalloc(&temp->__results, block_len * sizeof(int));
     cudaMalloc(&temp->__results_counter, sizeof(int));
+    cudaMalloc(&temp->__rejects, lset_len * sizeof(int));
+    cudaMemset(temp->__rejects, 0, lset_len * sizeof(int));
     temp->__lset_uploaded = false;
 
     *ctx = temp;
@@ -81,7 +87,8 @@ cudacover_result_t cudacover_check(cudacover_t* ctx,
                                 ctx->__block,
                                 block_len,
                                 ctx->__results,
-                                ctx->__results_counter);
+                                ctx->__results_counter,
+                                ctx->__rejects);
 
     cudaMemcpy(&ctx->results_counter, ctx->__results_counter, sizeof(int), cudaMemcpyDeviceToHost);
     cudaMemcpy(ctx->results, ctx->__results, ctx->results_counter * sizeof(int), cudaMemcpyDeviceToHost);
@@ -89,6 +96,52 @@ cudacover_result_t cudacover_check(cudacover_t* ctx,
     return CUDA_COVER_RESULT_OK;
 }
 
+static int* compare_rejects;
+
+static int compare_rows(const void* first, const void* second) {
+    int first_rejects = compare_rejects[*(const int*)first];
+    int second_rejects = compare_rejects[*(const int*)second];
+    if (first_rejects != second_rejects) {
+        return first_rejects > second_rejects ? -1 : 1;
+    }
+    return *(const int*)first - *(const int*)second;
+}
+
+// Moves rows which rejected most of candidates since the last call to the
+// beginning of lset, so that the kernel stops at them earlier
+cudacover_result_t cudacover_reorder(cudacover_t* ctx) {
+    if (ctx == NULL) {
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    cudaMemcpy(ctx->rejects, ctx->__rejects, ctx->lset_len * sizeof(int), cudaMemcpyDeviceToHost);
+    cudaMemset(ctx->__rejects, 0, ctx->lset_len * sizeof(int));
+
+    int* rows = (int*)malloc(ctx->lset_len * sizeof(int));
+    char* lset = (char*)malloc(ctx->lset_len * ctx->features * sizeof(char));
+    if (rows == NULL || lset == NULL) {
+        free(rows);
+        free(lset);
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    for (int i = 0; i < ctx->lset_len; ++i) {
+        rows[i] = i;
+    }
+    compare_rejects = ctx->rejects;
+    qsort(rows, ctx->lset_len, sizeof(int), compare_rows);
+
+    for (int i = 0; i < ctx->lset_len; ++i) {
+        memcpy(&lset[i * ctx->features], &ctx->lset[rows[i] * ctx->features], ctx->features * sizeof(char));
+    }
+    memcpy(ctx->lset, lset, ctx->lset_len * ctx->features * sizeof(char));
+    free(rows);
+    free(lset);
+
+    ctx->__lset_uploaded = false;
+    return CUDA_COVER_RESULT_OK;
+}
+
 cudacover_result_t cudacover_free(cudacover_t** ctx) {
     cudacover_t* temp = *ctx;
     if (temp == NULL) {
@@ -99,10 +152,12 @@ cudacover_result_t cudacover_free(cudacover_t** ctx) {
     cudaFree(temp->__block);
     cudaFree(temp->__results_counter);
     cudaFree(temp->__results);
+    cudaFree(temp->__rejects);
 
     free(temp->lset);
     free(temp->block);
     free(temp->results);
+    free(temp->rejects);
     free(temp);
 
     *ctx = NULL;
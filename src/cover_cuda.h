@@ -19,11 +19,17 @@ extern "C" {
         int results_counter;
         int* results;
 
+        int* rejects;
+
         bool __lset_uploaded;
         char* __lset;
         char* __block;
         int* __results_counter;
         int* __results;
+        int* __rejects;
+
+        // State of backend which doesn't use device buffers
+        void* __backend;
     } cudacover_t;
 
     typedef enum {
@@ -40,6 +46,8 @@ extern "C" {
                                        int block_len,
                                        int thread_block);
 
+    cudacover_result_t cudacover_reorder(cudacover_t* ctx);
+
     cudacover_result_t cudacover_free(cudacover_t** ctx);
 
 #ifdef __cplusplus
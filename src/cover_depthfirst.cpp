@@ -1,9 +1,11 @@
 #include <algorithm>
 #include <argparse.h>
 #include <stdexcept>
+#include <vector>
 
 #ifdef MULTITHREAD
-#include <queue>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <thread>
 #endif
@@ -37,7 +39,7 @@ public:
         _uimSets = new test_feature_t*[featuresLen+1];
         _uimSets[0] = uimSet;
         for (auto i = 1; i <= featuresLen; ++i) {
-            _uimSets[i] = new test_feature_t[featuresLen * uimSetLen];
+            _uimSets[i] = new test_feature_t[static_cast<size_t>(featuresLen) * uimSetLen];
         }
 
         _uimSetLens = new set_size_t[featuresLen+1];
@@ -81,55 +83,20 @@ public:
         delete [] _currentCovers;
     }
 
-    Context(Context&& another) :
-        _uimSets(another._uimSets),
-        _colors(another._colors),
-        _uimSetLens(another._uimSetLens),
-        _featuresLens(another._featuresLens),
-        _currentColumns(another._currentColumns),
-        _currentCovers(another._currentCovers),
-        _resultSet(another._resultSet),
-#ifdef MULTITHREAD
-        _resultsLock(another._resultsLock),
-#endif // MULTITHREAD
-        _limit(another._limit),
-        _needCover(another._needCover)
-        {
-        another._uimSets = nullptr;
-        another._uimSetLens = nullptr;
-        another._featuresLens = nullptr;
-        another._currentColumns = nullptr;
-        another._currentCovers = nullptr;
-    }
-
     Context(const Context&) = delete;
     Context& operator=(const Context&) = delete;
 
-    Context clone(feature_size_t depth) {
-        auto temp = Context(_uimSets[0],
-                            _colors,
-                            _uimSetLens[0],
-                            _featuresLens[0],
-                            _resultSet,
-#ifdef MULTITHREAD
-                            _resultsLock,
-#endif // MULTITHREAD
-                            _limit,
-                            _needCover);
-
-        for (auto i = 1; i <= depth; ++i) {
-            for (auto j = 0; j < _uimSetLens[i] * _featuresLens[i]; ++j) {
-                temp._uimSets[i][j] = _uimSets[i][j];
-            }
-            temp._uimSetLens[i] = _uimSetLens[i];
-            temp._featuresLens[i] = _featuresLens[i];
-            for (auto j = 0; j < _featuresLens[i]; ++j) {
-                temp._currentColumns[i][j] = _currentColumns[i][j];
-                temp._currentCovers[i][j] = _currentCovers[i][j];
-            }
-        }
-
-        return temp;
+    // Copies state of the level from other context of the same uim
+    void copyLevel(Context& other, feature_size_t depth) {
+        _uimSetLens[depth] = other._uimSetLens[depth];
+        _featuresLens[depth] = other._featuresLens[depth];
+        std::copy(&other._uimSets[depth][0],
+                  &other._uimSets[depth][static_cast<size_t>(_uimSetLens[depth]) * _featuresLens[depth]],
+                  &_uimSets[depth][0]);
+        std::copy(&other._currentColumns[depth][0], &other._currentColumns[depth][_featuresLens[depth]],
+                  &_currentColumns[depth][0]);
+        std::copy(&other._currentCovers[depth][0], &other._currentCovers[depth][_uimSetLens[depth]],
+                  &_currentCovers[depth][0]);
     }
 
     inline test_feature_t* getUimSet(feature_size_t depth) { return _uimSets[depth]; }
@@ -151,6 +118,51 @@ public:
 
 #ifdef MULTITHREAD
     inline std::mutex& getResultsLock() const { return *_resultsLock; }
+
+    // Unexplored siblings of every level of the search are published as
+    // frames. The owner takes branches from its deepest frame, as the
+    // recursion does, idle workers steal them from the shallowest one,
+    // where subtrees are the biggest
+    inline void pushFrame(feature_size_t depth, const feature_size_t* priorities, feature_size_t prioritiesLen) {
+        std::unique_lock<std::mutex> lock(_framesLock);
+        _frames.push_back({depth, priorities, prioritiesLen, 0});
+    }
+
+    inline void popFrame() {
+        std::unique_lock<std::mutex> lock(_framesLock);
+        _frames.pop_back();
+    }
+
+    inline bool takeFrame(feature_size_t& outId) {
+        std::unique_lock<std::mutex> lock(_framesLock);
+        auto& frame = _frames.back();
+        if (frame.next == frame.prioritiesLen) {
+            return false;
+        }
+        outId = frame.priorities[frame.next++];
+        return true;
+    }
+
+    // State of the level of stolen branch is shipped to the thief. The
+    // owner doesn't change a level until its frame is popped, and pop
+    // waits for the lock, so the state is consistent. Thief becomes active
+    // before the lock is released, so workers can't see all of them idle
+    // while a branch is taken out of frames
+    bool stealFrame(Context& thief, std::atomic<int>& active, feature_size_t& outDepth, feature_size_t& outId) {
+        std::unique_lock<std::mutex> lock(_framesLock);
+        for (auto& frame : _frames) {
+            if (frame.next == frame.prioritiesLen) {
+                continue;
+            }
+
+            outDepth = frame.depth;
+            outId = frame.priorities[frame.next++];
+            thief.copyLevel(*this, frame.depth);
+            active += 1;
+            return true;
+        }
+        return false;
+    }
 #endif
 
 private:
@@ -166,6 +178,16 @@ private:
     feature_size_t _needCover;
 #ifdef MULTITHREAD
     std::mutex* _resultsLock;
+
+    struct Frame {
+        feature_size_t depth;
+        const feature_size_t* priorities;
+        feature_size_t prioritiesLen;
+        feature_size_t next;
+    };
+
+    std::mutex _framesLock;
+    std::vector<Frame> _frames;
 #endif
 };
 
@@ -175,6 +197,16 @@ void depthWorker(Context& context,
                  feature_size_t depth,
                  feature_size_t current);
 
+void branchWorker(Context& context,
+                  feature_size_t depth,
+                  feature_size_t current);
+
+#ifdef MULTITHREAD
+void stealingWorker(Context& context,
+                    const std::vector<Context*>& contexts,
+                    std::atomic<int>& active);
+#endif
+
 void propagate(Context& context,
                feature_size_t depth,
                feature_size_t* columns,
@@ -198,7 +230,8 @@ void findCovering(feature_t* uim,
                   set_size_t limit,
                   feature_size_t needCover) {
 
-    test_feature_t nuim[uimSetLen * featuresLen];
+    std::vector<test_feature_t> nuimBuffer(static_cast<size_t>(uimSetLen) * featuresLen);
+    auto nuim = nuimBuffer.data();
     CoverCommon::binarize(uim, uimSetLen, featuresLen, nuim);
 
     feature_size_t colors[featuresLen];
@@ -243,39 +276,37 @@ void findCovering(feature_t* uim,
 
     if (!checkAndAppend(context, depth)) {
 #ifdef MULTITHREAD
-        std::queue<feature_size_t> tasks;
-        for (auto i = 0; i<prioritiesLen; ++i) {
-            tasks.push(i);
-        }
-
         auto maxThreads = parser_int_get_value(thread_count_arg);
         if (maxThreads == 0) {
             maxThreads = std::thread::hardware_concurrency();
         }
-        if (maxThreads > prioritiesLen) {
-            maxThreads = prioritiesLen;
+
+        // Branches of the first level are published by the main context,
+        // workers steal them as they steal from each other
+        context.pushFrame(depth, priorities, prioritiesLen);
+
+        std::vector<std::unique_ptr<Context>> workerContexts;
+        std::vector<Context*> contexts(1, &context);
+        for (auto threadId = 0; threadId < maxThreads; ++threadId) {
+            workerContexts.emplace_back(new Context(nuim,
+                                                    colors,
+                                                    uimSetLen,
+                                                    featuresLen,
+                                                    &resultSet,
+                                                    &resultsLock,
+                                                    limit,
+                                                    needCover));
+            contexts.push_back(workerContexts.back().get());
         }
 
-        std::mutex mutex;
+        std::atomic<int> active(0);
         std::vector<std::thread> threads(maxThreads);
         for (auto threadId = 0; threadId < maxThreads; ++threadId) {
             START_COLLECT_TIME(threading, Counters::Threading);
-            threads[threadId] = std::thread([threadId, &context, depth, &priorities, &tasks, &mutex]()
+            threads[threadId] = std::thread([threadId, &workerContexts, &contexts, &active]()
                                             {
                                                 TimeCollector::ThreadInitialize();
-                                                auto thContext = context.clone(depth);
-                                                for(;;) {
-                                                    feature_size_t id = 0;
-                                                    {
-                                                        std::unique_lock<std::mutex> mlock(mutex);
-                                                        if (tasks.empty()) {
-                                                            break;
-                                                        }
-                                                        id = tasks.front();
-                                                        tasks.pop();
-                                                    }
-                                                    depthWorker(thContext, depth, priorities[id]);
-                                                }
+                                                stealingWorker(*workerContexts[threadId], contexts, active);
                                                 TimeCollector::ThreadFinalize();
                                             });
             STOP_COLLECT_TIME(threading);
@@ -284,6 +315,8 @@ void findCovering(feature_t* uim,
         for (auto threadId = 0; threadId < maxThreads; ++threadId) {
             threads[threadId].join();
         }
+
+        context.popFrame();
 #else
         for (auto i=0; i<prioritiesLen; ++i) {
             depthWorker(context, depth, priorities[i]);
@@ -396,16 +429,65 @@ void depthWorker(Context& context,
         }
     }
 
+#ifdef MULTITHREAD
+    context.pushFrame(depth, priorities, prioritiesLen);
+    feature_size_t id;
+    while (context.takeFrame(id)) {
+        branchWorker(context, depth, id);
+    }
+    context.popFrame();
+#else
     for (auto i=0; i<prioritiesLen; ++i) {
-        auto handle = depth <= context.getColor(depth, priorities[i]);
+        branchWorker(context, depth, priorities[i]);
+    }
+#endif
+}
 
-        DEBUG_INFO("column " << context.getCurrentColumns(depth)[priorities[i]]
-                   << ", handle: " << handle
-                   << ", depth: " << depth
-                   << ", prevColor: " << context.getColor(depth, priorities[i]));
+void branchWorker(Context& context,
+                  feature_size_t depth,
+                  feature_size_t current) {
 
-        if (handle) {
-            depthWorker(context, depth, priorities[i]);
+    auto handle = depth <= context.getColor(depth, current);
+
+    DEBUG_INFO("column " << context.getCurrentColumns(depth)[current]
+               << ", handle: " << handle
+               << ", depth: " << depth
+               << ", prevColor: " << context.getColor(depth, current));
+
+    if (handle) {
+        depthWorker(context, depth, current);
+    }
+}
+
+#ifdef MULTITHREAD
+void stealingWorker(Context& context,
+                    const std::vector<Context*>& contexts,
+                    std::atomic<int>& active) {
+
+    feature_size_t depth;
+    feature_size_t id;
+
+    for (;;) {
+        auto stolen = false;
+        for (auto victim : contexts) {
+            if (victim != &context && victim->stealFrame(context, active, depth, id)) {
+                stolen = true;
+                break;
+            }
         }
+
+        if (!stolen) {
+            // Only active workers publish branches, all of them are
+            // explored when none is active
+            if (active.load() == 0) {
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        branchWorker(context, depth, id);
+        active -= 1;
     }
 }
+#endif
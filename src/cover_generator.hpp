@@ -1,66 +1,206 @@
 #ifndef COVER_GENERATOR_H
 #define COVER_GENERATOR_H
 
-class CoverGenerator {
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "global_settings.h"
+
+typedef uint64_t cover_rank_t;
+
+// Ranks above the limit are never reached in practice, so binomials and
+// offsets are saturated at it instead of overflowing
+const cover_rank_t cover_rank_limit = static_cast<cover_rank_t>(1) << 62;
+
+// Generates combinations of columns by increasing size. Every combination
+// has global rank: combinations of size k follow all smaller ones and are
+// ordered colexicographically by the combinatorial number system, so any of
+// them is restored from its rank directly. Workers claim ranges of ranks by
+// one atomic addition and walk through them by cursors independently.
+// Column c of the order is reported as size-1-c, that keeps the order of
+// candidates the same as it was for the search by sequential generator.
+// Generation may be cut at the first combination of some size, when
+// combinations of that size can't be useful anymore
+class CoverGenerator final {
+
 public:
+    class Cursor final {
 
-    CoverGenerator(uint_fast16_t size) {
-        _size = size;
-        _seed = 0;
-        _current = new uint_fast8_t[size];
-    }
+    public:
+        Cursor(const CoverGenerator& generator) :
+            _generator(generator),
+            _combination(generator._size + 1),
+            _columns(generator._size),
+            _columnsLen(0),
+            _changedLen(0) { }
+
+        // Restores combination of the global rank
+        void seek(cover_rank_t rank) {
+            auto& offsets = _generator._offsets;
+            _columnsLen = std::upper_bound(offsets.begin() + 1, offsets.end(), rank) - offsets.begin() - 1;
+
+            auto rest = rank - offsets[_columnsLen];
+            auto upper = _generator._size;
+            for (auto i = _columnsLen; i > 0; --i) {
+                upper -= 1;
+                while (_generator.getBinomial(upper, i) > rest) {
+                    upper -= 1;
+                }
+                rest -= _generator.getBinomial(upper, i);
+                setColumn(i - 1, upper);
+            }
+            _combination[_columnsLen] = _generator._size;
+            _changedLen = _columnsLen;
+        }
 
-    inline uint_fast16_t next(uint_fast8_t* buffer, uint_fast16_t amount) {
-        uint_fast16_t count = 0;
-            
-        for (;;) {
-            if (count == amount) {
-                return count;
+        // Moves to the successor in colexicographical order: the lowest
+        // column which can be moved up is incremented and columns below it
+        // are packed to the bottom, as Gosper's hack does for bitmasks.
+        // Returns false after the last combination
+        inline bool next() {
+            feature_size_t i = 0;
+            while (i + 1 < _columnsLen && _combination[i] + 1 == _combination[i + 1]) {
+                setColumn(i, i);
+                i += 1;
             }
-            if (_seed > _size) {
-                return count;
+
+            if (i < _columnsLen && _combination[i] + 1 < _combination[i + 1]) {
+                setColumn(i, _combination[i] + 1);
+                _changedLen = i + 1;
+                return true;
             }
-            
-            uint_fast16_t index = _size - 1;
-            while (index > 0 && !(_current[index] == 1 && _current[index-1] == 0)) {
-                index -= 1;
+
+            if (_columnsLen == _generator._size) {
+                return false;
             }
 
-            uint_fast16_t amount = 0;
-            
-            if (index != 0) {
-                _current[index - 1] = 1;
-                for (uint_fast16_t i = index + 1; i < _size; ++i) {
-                    amount += _current[i];
-                }
-            } else {
-                _seed += 1;
-                if (_seed > _size) {
-                    return count;
-                }
-                
-                amount = _seed;
+            _columnsLen += 1;
+            for (feature_size_t j = 0; j < _columnsLen; ++j) {
+                setColumn(j, j);
             }
+            _combination[_columnsLen] = _generator._size;
+            _changedLen = _columnsLen;
+            return true;
+        }
+
+        inline const feature_size_t* getColumns() const { return _columns.data(); }
+        inline feature_size_t getColumnsLen() const { return _columnsLen; }
+        // Amount of the lowest positions changed by the last step
+        inline feature_size_t getChangedLen() const { return _changedLen; }
 
-            for (uint_fast16_t i = 0; i < (_size - index + 1); ++i) {
-                _current[_size - i] = i <= amount ? 1 : 0;
+        inline void fill(test_feature_t* buffer) const {
+            std::fill(&buffer[0], &buffer[_generator._size], 0);
+            for (feature_size_t j = 0; j < _columnsLen; ++j) {
+                buffer[_columns[j]] = 1;
             }
+        }
+
+    private:
+        inline void setColumn(feature_size_t index, feature_size_t column) {
+            _combination[index] = column;
+            _columns[index] = _generator._size - 1 - column;
+        }
 
-            for (uint_fast16_t i = 0; i < _size; ++i) {
-                buffer[_size * count + i] = _current[i];
+    private:
+        const CoverGenerator& _generator;
+        // Columns of colexicographical order followed by size as a sentinel
+        std::vector<feature_size_t> _combination;
+        std::vector<feature_size_t> _columns;
+        feature_size_t _columnsLen;
+        feature_size_t _changedLen;
+    };
+
+    CoverGenerator(feature_size_t size) :
+        _size(size),
+        _nextRank(0),
+        _endRank(0)
+    {
+        // Table covers sizes of combinations up to the first one which
+        // exceeds the limit, combinations of bigger sizes are unreachable
+        _offsets.push_back(0);
+        _offsets.push_back(0);
+        for (feature_size_t k = 1; k <= _size && _offsets.back() < cover_rank_limit; ++k) {
+            _binomials.resize(static_cast<size_t>(k + 1) * (_size + 1));
+            for (feature_size_t n = 0; n <= _size; ++n) {
+                _binomials[static_cast<size_t>(k) * (_size + 1) + n] =
+                    k <= n ? addRanks(getBinomial(n - 1, k - 1), getBinomial(n - 1, k)) : 0;
             }
-            count += 1;
+            _offsets.push_back(addRanks(_offsets.back(), getBinomial(_size, k)));
         }
+        _endRank = _offsets.back();
     }
 
-    virtual ~CoverGenerator() {
-        delete [] _current;
+    // Claims up to amount of next ranks as [outFirst, outLast), returns
+    // false when all combinations are given out
+    inline bool claim(cover_rank_t amount, cover_rank_t& outFirst, cover_rank_t& outLast) {
+        auto end = getEndRank();
+        if (_nextRank.load(std::memory_order_relaxed) >= end) {
+            return false;
+        }
+
+        outFirst = _nextRank.fetch_add(amount);
+        if (outFirst >= end) {
+            return false;
+        }
+
+        outLast = std::min(outFirst + amount, end);
+        return true;
+    }
+
+    // Stops generation before combinations of the size, ranges which are
+    // claimed already should be left at the end rank
+    inline void limitSize(feature_size_t size) {
+        auto end = _offsets[std::min<size_t>(size, _offsets.size() - 1)];
+        auto current = _endRank.load();
+        while (end < current && !_endRank.compare_exchange_weak(current, end)) {
+        }
+    }
+
+    inline cover_rank_t getEndRank() const { return _endRank.load(std::memory_order_relaxed); }
+
+    // Writes next combinations to the buffer as rows of size flags,
+    // returns amount of written combinations
+    inline set_size_t next(test_feature_t* buffer, set_size_t amount) {
+        cover_rank_t first, last;
+        if (!claim(amount, first, last)) {
+            return 0;
+        }
+
+        Cursor cursor(*this);
+        cursor.seek(first);
+        for (auto rank = first; rank < last; ++rank) {
+            cursor.fill(&buffer[static_cast<size_t>(rank - first) * _size]);
+            cursor.next();
+        }
+        return static_cast<set_size_t>(last - first);
+    }
+
+    inline cover_rank_t getRanksLen() const { return _offsets.back(); }
+
+private:
+    inline cover_rank_t getBinomial(feature_size_t n, feature_size_t k) const {
+        if (k == 0) {
+            return 1;
+        }
+        return _binomials[static_cast<size_t>(k) * (_size + 1) + n];
+    }
+
+    static inline cover_rank_t addRanks(cover_rank_t first, cover_rank_t second) {
+        return std::min(first + second, cover_rank_limit);
     }
 
 private:
-    uint_fast16_t _size;
-    uint_fast16_t _seed;
-    uint_fast8_t* _current;
+    feature_size_t _size;
+
+    // Binomials C(n, k) by rows of k, row of k=0 isn't used
+    std::vector<cover_rank_t> _binomials;
+    // Global rank of the first combination of every size, the last one is
+    // amount of reachable combinations
+    std::vector<cover_rank_t> _offsets;
+
+    std::atomic<cover_rank_t> _nextRank;
+    std::atomic<cover_rank_t> _endRank;
 };
 
 #endif // COVER_GENERATOR_H
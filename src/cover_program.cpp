@@ -2,6 +2,7 @@
 #include <fstream>
 
 #include "global_settings.h"
+#include "cpu_dispatch.hpp"
 #include "timecollector.hpp"
 #include "datafile.hpp"
 #include "resultset.hpp"
@@ -46,6 +47,12 @@ int main(int argc, char** argv)
     parser_flag_add_arg(parser, &no_transfer, "--no-transfer");
     parser_flag_set_help(no_transfer, "no transfer blocks from input file to output");
 
+    parser_string_arg_t* isa_arg;
+    parser_string_add_arg(parser, &isa_arg, "--isa");
+    parser_string_set_help(isa_arg, "force instruction set of kernels: baseline, avx2 or avx512, "
+                                    "the best supported one is used by default");
+    parser_string_set_default(isa_arg, "");
+
     initArgParser(parser);
 
     if (parser_parse(parser, argc, argv) != PARSER_RESULT_OK) {
@@ -54,15 +61,21 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (!CpuDispatch::forceLevel(parser_string_get_value(isa_arg))) {
+        printf("Instruction set should be baseline, avx2 or avx512 and supported by CPU\n");
+        parser_free(&parser);
+        return 1;
+    }
+
     TimeCollector::Initialize();
     TimeCollector::ThreadInitialize();
     TimeCollectorEntry executionTime(Counters::All);
 
     START_COLLECT_TIME(readingInput, Counters::ReadingInput);
     DataFile dataFile;
+    dataFile.setParsedBlocks(DataFile::UimBlock);
     if (strcmp("-", parser_string_get_value(input_arg)) != 0) {
-        std::ifstream input_stream(parser_string_get_value(input_arg));
-        dataFile.load(input_stream);
+        dataFile.load(std::string(parser_string_get_value(input_arg)));
     } else {
         dataFile.load(std::cin);
     }
@@ -85,8 +98,8 @@ int main(int argc, char** argv)
         dataFile.reset();
     }
 
-    auto tests = new feature_t[resultSet.getSize() * featuresLen];
-    for(auto i=0; i<resultSet.getSize(); ++i) {
+    auto tests = new feature_t[static_cast<size_t>(resultSet.getSize()) * featuresLen];
+    for(size_t i=0; i<resultSet.getSize(); ++i) {
         for(auto j=0; j<featuresLen; ++j) {
             tests[i * featuresLen + j] = resultSet.get(i)[j];
         }
@@ -97,8 +110,7 @@ int main(int argc, char** argv)
                              featuresLen);
 
     if (strcmp("-", output_arg->value) != 0) {
-        std::ofstream output_stream(output_arg->value);
-        dataFile.save(output_stream);
+        dataFile.save(std::string(output_arg->value));
     } else {
         dataFile.save(std::cout);
     }
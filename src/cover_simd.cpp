@@ -0,0 +1,409 @@
+#include "cover_cuda.h"
+#include "cpu_dispatch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <vector>
+
+#ifdef MULTITHREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// CPU implementation of the batch coverage check of cover_cuda.h. The lset
+// is converted to column bitsets over rows when it's uploaded, rows with
+// the least amount of nonzero values go first. Candidates are checked by
+// vectors of row words with early exit, counters of rows for cover_koef > 1
+// are bit-sliced and saturate at cover_koef. Block of candidates is split
+// between the caller and workers, which live as long as the context
+
+typedef uint64_t simd_word_t;
+// Vectors are read from arrays of words, which aren't aligned by 32 bytes,
+// so the type has alignment of its words and is loaded unaligned
+typedef simd_word_t simd_vector_t __attribute__((vector_size(32), aligned(sizeof(simd_word_t)), may_alias));
+
+const int SIMD_WORD_BITS = 64;
+const int SIMD_VECTOR_WORDS = sizeof(simd_vector_t) / sizeof(simd_word_t);
+const int SIMD_VECTOR_BITS = SIMD_WORD_BITS * SIMD_VECTOR_WORDS;
+const int SIMD_MAX_PLANES = 32;
+
+// Every thread checks at least this amount of candidates of a block
+const int SIMD_PART_SIZE = 64;
+
+struct simdcover_t {
+    int vectors_len;
+    int planes_len;
+
+    // features bitsets of vectors_len vectors, kept as words
+    std::vector<simd_word_t> columns;
+    // Padding rows of the last vector are saturated from the start
+    std::vector<simd_word_t> initial;
+
+    // Vectors in order of checking, reordered by rejections
+    std::vector<int> order;
+    std::vector<int> rejects;
+
+    // Results and rejections of parts of the current block
+    std::vector<std::vector<int>> part_results;
+    std::vector<std::vector<int>> part_rejects;
+
+#ifdef MULTITHREAD
+    // Worker with index i checks part i + 1 of every block, which has it,
+    // part 0 is checked by the caller
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    // Incremented for every block, workers wait for the next one
+    uint64_t generation;
+    bool stopped;
+    int pending;
+
+    const cudacover_t* block_ctx;
+    int block_len;
+    int parts_count;
+    int part_size;
+#endif
+};
+
+static ISA_INLINE bool isFull(const simd_vector_t& vector) {
+    simd_word_t result = vector[0];
+    for (int i = 1; i < SIMD_VECTOR_WORDS; ++i) {
+        result &= vector[i];
+    }
+    return result == ~static_cast<simd_word_t>(0);
+}
+
+static void uploadLset(cudacover_t* ctx, simdcover_t* data) {
+    data->vectors_len = (ctx->lset_len + SIMD_VECTOR_BITS - 1) / SIMD_VECTOR_BITS;
+    data->planes_len = 0;
+    while ((1LL << data->planes_len) <= ctx->cover_koef && data->planes_len < SIMD_MAX_PLANES) {
+        data->planes_len += 1;
+    }
+
+    std::vector<int> rows(ctx->lset_len);
+    std::vector<int> spare(ctx->lset_len, 0);
+    for (int i = 0; i < ctx->lset_len; ++i) {
+        rows[i] = i;
+        for (int j = 0; j < ctx->features; ++j) {
+            spare[i] += ctx->lset[static_cast<size_t>(i) * ctx->features + j] ? 1 : 0;
+        }
+    }
+    std::stable_sort(rows.begin(), rows.end(), [&spare](int first, int second) {
+        return spare[first] < spare[second];
+    });
+
+    auto wordsLen = static_cast<size_t>(data->vectors_len) * SIMD_VECTOR_WORDS;
+    data->columns.assign(ctx->features * wordsLen, 0);
+    data->initial.assign(wordsLen, 0);
+
+    auto columns = data->columns.data();
+    auto initial = data->initial.data();
+    for (size_t i = 0; i < wordsLen * SIMD_WORD_BITS; ++i) {
+        auto word = i / SIMD_WORD_BITS;
+        auto bit = static_cast<simd_word_t>(1) << (i % SIMD_WORD_BITS);
+
+        if (i >= static_cast<size_t>(ctx->lset_len) || ctx->cover_koef <= 0) {
+            initial[word] |= bit;
+            continue;
+        }
+
+        auto row = &ctx->lset[static_cast<size_t>(rows[i]) * ctx->features];
+        for (int j = 0; j < ctx->features; ++j) {
+            if (row[j]) {
+                columns[j * wordsLen + word] |= bit;
+            }
+        }
+    }
+
+    data->order.resize(data->vectors_len);
+    for (int v = 0; v < data->vectors_len; ++v) {
+        data->order[v] = v;
+    }
+    data->rejects.assign(data->vectors_len, 0);
+}
+
+// Returns index of rejecting vector, or -1 when every row is covered
+static ISA_INLINE int checkCandidate(const cudacover_t* ctx, const simdcover_t* data, const int* columns, int columnsLen) {
+    auto vectorsLen = data->vectors_len;
+    // Types are explicit, deduction drops alignment of vector type
+    const simd_vector_t* vectors = reinterpret_cast<const simd_vector_t*>(data->columns.data());
+    const simd_vector_t* initial = reinterpret_cast<const simd_vector_t*>(data->initial.data());
+    simd_vector_t full = ~simd_vector_t{};
+
+    if (ctx->cover_koef == 1) {
+        for (int i = 0; i < vectorsLen; ++i) {
+            auto v = data->order[i];
+            simd_vector_t covered = initial[v];
+            for (int c = 0; c < columnsLen; ++c) {
+                covered |= vectors[static_cast<size_t>(columns[c]) * vectorsLen + v];
+            }
+            if (!isFull(covered)) {
+                return v;
+            }
+        }
+        return -1;
+    }
+
+    simd_vector_t planes[SIMD_MAX_PLANES];
+    for (int i = 0; i < vectorsLen; ++i) {
+        auto v = data->order[i];
+        simd_vector_t saturated = initial[v];
+        for (int b = 0; b < data->planes_len; ++b) {
+            planes[b] = simd_vector_t{};
+        }
+
+        for (int c = 0; c < columnsLen && !isFull(saturated); ++c) {
+            simd_vector_t carry = vectors[static_cast<size_t>(columns[c]) * vectorsLen + v] & ~saturated;
+            simd_vector_t reached = full;
+            for (int b = 0; b < data->planes_len; ++b) {
+                simd_vector_t plane = planes[b] ^ carry;
+                carry &= planes[b];
+                planes[b] = plane;
+                reached &= ((ctx->cover_koef >> b) & 1) ? plane : ~plane;
+            }
+            saturated |= reached;
+        }
+
+        if (!isFull(saturated)) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+// Checks candidates [begin, end) of the block, indexes of covering ones are
+// written to results
+static ISA_INLINE void checkPart(const cudacover_t* ctx, const simdcover_t* data, int begin, int end,
+                      std::vector<int>& results, std::vector<int>& rejects) {
+    std::vector<int> columns(ctx->features);
+    for (int index = begin; index < end; ++index) {
+        auto candidate = &ctx->block[static_cast<size_t>(index) * ctx->features];
+        int columnsLen = 0;
+        for (int j = 0; j < ctx->features; ++j) {
+            if (candidate[j]) {
+                columns[columnsLen++] = j;
+            }
+        }
+
+        auto rejecting = checkCandidate(ctx, data, columns.data(), columnsLen);
+        if (rejecting < 0) {
+            results.push_back(index);
+        } else {
+            rejects[rejecting] += 1;
+        }
+    }
+}
+
+ISA_VARIANTS(checkPartVariant, void,
+             (const cudacover_t* ctx, const simdcover_t* data, int begin, int end,
+              std::vector<int>& results, std::vector<int>& rejects),
+             (checkPart(ctx, data, begin, end, results, rejects)))
+
+static const IsaKernel<decltype(&checkPartVariantBaseline)> checkPartKernel(ISA_KERNEL(checkPartVariant));
+
+static void checkBlockPart(const cudacover_t* ctx, simdcover_t* data, int part, int partSize, int blockLen) {
+    auto& results = data->part_results[part];
+    auto& rejects = data->part_rejects[part];
+    results.clear();
+    rejects.assign(data->vectors_len, 0);
+    checkPartKernel.get()(ctx, data, part * partSize, std::min(blockLen, (part + 1) * partSize),
+                          results, rejects);
+}
+
+#ifdef MULTITHREAD
+static void workerLoop(simdcover_t* data, int part) {
+    uint64_t generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(data->mutex);
+            data->started.wait(lock, [data, generation]() {
+                return data->stopped || data->generation != generation;
+            });
+            if (data->stopped) {
+                return;
+            }
+            generation = data->generation;
+            if (part >= data->parts_count) {
+                continue;
+            }
+        }
+
+        try {
+            checkBlockPart(data->block_ctx, data, part, data->part_size, data->block_len);
+        } catch (...) {
+            data->errors[part] = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(data->mutex);
+        if (--data->pending == 0) {
+            data->finished.notify_one();
+        }
+    }
+}
+#endif
+
+cudacover_result_t cudacover_init(cudacover_t** ctx,
+                                  int lset_len,
+                                  int features,
+                                  int block_len) {
+    cudacover_t* temp = new (std::nothrow) cudacover_t();
+    if (temp == nullptr) {
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    temp->cover_koef = 1;
+    temp->lset_len = lset_len;
+    temp->features = features;
+    temp->block_len = block_len;
+    temp->lset = new char[static_cast<size_t>(lset_len) * features];
+    temp->block = new char[static_cast<size_t>(block_len) * features];
+    temp->results = new int[block_len];
+    temp->results_counter = 0;
+    temp->rejects = nullptr;
+
+    temp->__lset_uploaded = false;
+
+    auto data = new simdcover_t();
+    int partsCount = 1;
+#ifdef MULTITHREAD
+    partsCount = std::max(1u, std::thread::hardware_concurrency());
+    data->errors.resize(partsCount);
+    data->generation = 0;
+    data->stopped = false;
+    data->pending = 0;
+    for (int part = 1; part < partsCount; ++part) {
+        data->workers.emplace_back(workerLoop, data, part);
+    }
+#endif
+    data->part_results.resize(partsCount);
+    data->part_rejects.resize(partsCount);
+    temp->__backend = data;
+
+    *ctx = temp;
+    return CUDA_COVER_RESULT_OK;
+}
+
+cudacover_result_t cudacover_check(cudacover_t* ctx,
+                                   int block_len,
+                                   int thread_block) {
+    if (ctx == nullptr) {
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    // Threads of GPU block have no meaning for CPU, block is split
+    // between workers instead
+    (void)thread_block;
+
+    auto data = static_cast<simdcover_t*>(ctx->__backend);
+    if (!ctx->__lset_uploaded) {
+        ctx->__lset_uploaded = true;
+        uploadLset(ctx, data);
+    }
+
+    int partsCount = std::max(1, std::min<int>(data->part_results.size(),
+                                               (block_len + SIMD_PART_SIZE - 1) / SIMD_PART_SIZE));
+    auto partSize = (block_len + partsCount - 1) / partsCount;
+
+#ifdef MULTITHREAD
+    if (partsCount > 1) {
+        std::lock_guard<std::mutex> lock(data->mutex);
+        data->block_ctx = ctx;
+        data->block_len = block_len;
+        data->parts_count = partsCount;
+        data->part_size = partSize;
+        data->pending = partsCount - 1;
+        data->generation += 1;
+        data->started.notify_all();
+    }
+#endif
+
+    std::exception_ptr error;
+    try {
+        checkBlockPart(ctx, data, 0, partSize, block_len);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+#ifdef MULTITHREAD
+    if (partsCount > 1) {
+        std::unique_lock<std::mutex> lock(data->mutex);
+        data->finished.wait(lock, [data]() {
+            return data->pending == 0;
+        });
+    }
+    for (int part = 1; part < partsCount; ++part) {
+        if (!error && data->errors[part]) {
+            error = data->errors[part];
+        }
+        data->errors[part] = nullptr;
+    }
+#endif
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    // Parts are merged in order, so results are ordered as candidates
+    for (int part = 0; part < partsCount; ++part) {
+        for (auto index : data->part_results[part]) {
+            ctx->results[ctx->results_counter++] = index;
+        }
+        for (int v = 0; v < data->vectors_len; ++v) {
+            data->rejects[v] += data->part_rejects[part][v];
+        }
+    }
+
+    return CUDA_COVER_RESULT_OK;
+}
+
+// Vectors which rejected most of candidates since the last call are
+// checked first, rows within vectors are kept as they are
+cudacover_result_t cudacover_reorder(cudacover_t* ctx) {
+    if (ctx == nullptr) {
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    auto data = static_cast<simdcover_t*>(ctx->__backend);
+    if (!ctx->__lset_uploaded) {
+        return CUDA_COVER_RESULT_OK;
+    }
+
+    std::stable_sort(data->order.begin(), data->order.end(), [data](int first, int second) {
+        return data->rejects[first] > data->rejects[second];
+    });
+    std::fill(data->rejects.begin(), data->rejects.end(), 0);
+
+    return CUDA_COVER_RESULT_OK;
+}
+
+cudacover_result_t cudacover_free(cudacover_t** ctx) {
+    cudacover_t* temp = *ctx;
+    if (temp == nullptr) {
+        return CUDA_COVER_RESULT_ERR;
+    }
+
+    auto data = static_cast<simdcover_t*>(temp->__backend);
+#ifdef MULTITHREAD
+    {
+        std::lock_guard<std::mutex> lock(data->mutex);
+        data->stopped = true;
+        data->started.notify_all();
+    }
+    for (auto& worker : data->workers) {
+        worker.join();
+    }
+#endif
+    delete data;
+    delete [] temp->lset;
+    delete [] temp->block;
+    delete [] temp->results;
+    delete temp;
+
+    *ctx = nullptr;
+    return CUDA_COVER_RESULT_OK;
+}
@@ -0,0 +1,166 @@
+#ifndef COVERING_FILTER_H
+#define COVERING_FILTER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "global_settings.h"
+#include "feature_words.hpp"
+
+// Found coverings kept as bitmasks over columns. Candidate which contains
+// any of them isn't irreducible, so it's skipped before the coverage check.
+// For every position of combination the filter keeps coverings which still
+// can be contained: ones having no more columns out of the upper columns
+// than there are positions below. Lists are narrowed from the top position
+// down and only the ones of changed positions are rebuilt after a step.
+// The lowest position is checked by a single bit test against the mask of
+// columns which complete some covering
+class CoveringFilter final {
+
+public:
+    CoveringFilter(feature_size_t featuresLen) :
+        _wordsLen(getFeatureWordsLen(featuresLen)),
+        _size(0),
+        _upper(_wordsLen),
+        _completing(_wordsLen),
+        _upperContains(false),
+        _columnsLen(0),
+        _valid(false) { }
+
+    inline set_size_t getSize() const { return _size; }
+
+    void append(const feature_size_t* columns, feature_size_t columnsLen) {
+        _coverings.resize(static_cast<size_t>(_size + 1) * _wordsLen, 0);
+        auto covering = &_coverings[static_cast<size_t>(_size) * _wordsLen];
+        for (feature_size_t c = 0; c < columnsLen; ++c) {
+            covering[columns[c] / feature_word_bits] |= static_cast<feature_word_t>(1) << (columns[c] % feature_word_bits);
+        }
+        _coveringsLens.push_back(columnsLen);
+        _size += 1;
+        _valid = false;
+    }
+
+    // Takes coverings appended to the other filter since the last update
+    void update(const CoveringFilter& other) {
+        if (other._size == _size) {
+            return;
+        }
+
+        _coverings.insert(_coverings.end(),
+                          other._coverings.begin() + static_cast<size_t>(_size) * _wordsLen,
+                          other._coverings.begin() + static_cast<size_t>(other._size) * _wordsLen);
+        _coveringsLens.insert(_coveringsLens.end(),
+                              other._coveringsLens.begin() + _size,
+                              other._coveringsLens.end());
+        _size = other._size;
+        _valid = false;
+    }
+
+    // Positions below changedLen differ from the previous call
+    inline bool contains(const feature_size_t* columns, feature_size_t columnsLen, feature_size_t changedLen) {
+        if (_size == 0) {
+            return false;
+        }
+
+        if (!_valid || columnsLen != _columnsLen) {
+            reset(columnsLen);
+            changedLen = columnsLen + 1;
+        }
+
+        if (_lists[columnsLen].empty()) {
+            return false;
+        }
+
+        // Upper columns start from position 1, they are the same when
+        // only the lowest position is changed
+        if (changedLen > 1) {
+            for (auto p = std::min(changedLen - 1, columnsLen - 1); p >= 1; --p) {
+                narrow(p, columns[p]);
+            }
+            FEATURE_WORDS_DISPATCH(_wordsLen, reduce<WORDS>(columns, columnsLen));
+        }
+
+        return _upperContains ||
+               (_completing[columns[0] / feature_word_bits] >> (columns[0] % feature_word_bits)) & 1;
+    }
+
+private:
+    struct Entry {
+        set_size_t index;
+        // Amount of columns out of the upper ones
+        feature_size_t rest;
+    };
+
+    inline bool hasColumn(set_size_t index, feature_size_t column) const {
+        return (_coverings[static_cast<size_t>(index) * _wordsLen + column / feature_word_bits] >> (column % feature_word_bits)) & 1;
+    }
+
+    void reset(feature_size_t columnsLen) {
+        _valid = true;
+        _columnsLen = columnsLen;
+        _lists.resize(columnsLen + 1);
+
+        auto& top = _lists[columnsLen];
+        top.clear();
+        for (set_size_t i = 0; i < _size; ++i) {
+            // Combination of the same size can't contain other covering
+            if (_coveringsLens[i] < columnsLen) {
+                top.push_back({i, _coveringsLens[i]});
+            }
+        }
+    }
+
+    // Builds list of the position from the list above it
+    void narrow(feature_size_t position, feature_size_t column) {
+        auto& list = _lists[position];
+        list.clear();
+        for (auto& entry : _lists[position + 1]) {
+            auto rest = entry.rest - (hasColumn(entry.index, column) ? 1 : 0);
+            if (rest <= position) {
+                list.push_back({entry.index, rest});
+            }
+        }
+    }
+
+    // Covering is contained when it has no columns out of upper ones,
+    // it's completed by the lowest column when it has exactly one
+    template<feature_size_t WordsLen>
+    void reduce(const feature_size_t* columns, feature_size_t columnsLen) {
+        typedef FeatureWords<WordsLen> Words;
+
+        _upperContains = false;
+        std::fill(_completing.begin(), _completing.end(), 0);
+
+        std::fill(_upper.begin(), _upper.end(), 0);
+        for (feature_size_t c = 1; c < columnsLen; ++c) {
+            _upper[columns[c] / feature_word_bits] |= static_cast<feature_word_t>(1) << (columns[c] % feature_word_bits);
+        }
+
+        for (auto& entry : _lists[1]) {
+            if (entry.rest == 0) {
+                _upperContains = true;
+                return;
+            }
+
+            Words::orAndNot(&_coverings[static_cast<size_t>(entry.index) * _wordsLen], _upper.data(),
+                            _completing.data(), _wordsLen);
+        }
+    }
+
+private:
+    feature_size_t _wordsLen;
+
+    // size bitsets of wordsLen words
+    std::vector<feature_word_t> _coverings;
+    std::vector<feature_size_t> _coveringsLens;
+    set_size_t _size;
+
+    std::vector<std::vector<Entry>> _lists;
+    std::vector<feature_word_t> _upper;
+    std::vector<feature_word_t> _completing;
+    bool _upperContains;
+    feature_size_t _columnsLen;
+    bool _valid;
+};
+
+#endif // COVERING_FILTER_H
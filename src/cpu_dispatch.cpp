@@ -0,0 +1,65 @@
+#include "cpu_dispatch.hpp"
+
+const char* isaLevelNames[] = {
+    "baseline",
+    "avx2",
+    "avx512"
+};
+
+IsaLevel CpuDispatch::_level = CpuDispatch::detectLevel();
+
+bool CpuDispatch::isSupported(IsaLevel level)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    switch (level) {
+    case IsaLevel::Baseline:
+        return true;
+    case IsaLevel::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") &&
+               __builtin_cpu_supports("popcnt");
+    case IsaLevel::Avx512:
+        return isSupported(IsaLevel::Avx2) && __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+    default:
+        return false;
+    }
+#else
+    return level == IsaLevel::Baseline;
+#endif
+}
+
+const char* CpuDispatch::getLevelName(IsaLevel level)
+{
+    return isaLevelNames[static_cast<int>(level)];
+}
+
+bool CpuDispatch::forceLevel(const std::string& name)
+{
+    if (name.empty()) {
+        return true;
+    }
+
+    for (auto i = 0; i < static_cast<int>(IsaLevel::IsaLevelsCount); ++i) {
+        if (name == isaLevelNames[i]) {
+            if (!isSupported(static_cast<IsaLevel>(i))) {
+                return false;
+            }
+            _level = static_cast<IsaLevel>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+IsaLevel CpuDispatch::detectLevel()
+{
+    if (isSupported(IsaLevel::Avx512)) {
+        return IsaLevel::Avx512;
+    } else if (isSupported(IsaLevel::Avx2)) {
+        return IsaLevel::Avx2;
+    }
+    return IsaLevel::Baseline;
+}
@@ -0,0 +1,75 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <string>
+
+// Hot kernels are compiled for several instruction sets in one binary, the
+// level is detected by cpuid at startup and may be forced for benchmarking
+enum class IsaLevel : int
+{
+    Baseline,
+    Avx2,
+    Avx512,
+    IsaLevelsCount
+};
+
+class CpuDispatch
+{
+
+public:
+    static inline IsaLevel getLevel() {
+        return _level;
+    }
+
+    static bool isSupported(IsaLevel level);
+    static const char* getLevelName(IsaLevel level);
+
+    // Returns false for unknown name or level which isn't supported by CPU,
+    // empty name keeps the detected level
+    static bool forceLevel(const std::string& name);
+
+private:
+    static IsaLevel detectLevel();
+
+    static IsaLevel _level;
+};
+
+// Variants of a kernel for every level, chosen by the current level on call
+template<typename Function>
+class IsaKernel final
+{
+
+public:
+    constexpr IsaKernel(Function baseline, Function avx2, Function avx512) :
+        _functions{baseline, avx2, avx512} {}
+
+    inline Function get() const {
+        return _functions[static_cast<int>(CpuDispatch::getLevel())];
+    }
+
+private:
+    Function _functions[static_cast<int>(IsaLevel::IsaLevelsCount)];
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISA_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define ISA_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2,popcnt")))
+#else
+#define ISA_TARGET_AVX2
+#define ISA_TARGET_AVX512
+#endif
+
+// Body of a kernel should be always inlined, so it's compiled for the
+// instruction set of every variant
+#define ISA_INLINE inline __attribute__((always_inline))
+
+// Defines name##Baseline, name##Avx2 and name##Avx512 with params, all of
+// them return the result of call
+#define ISA_VARIANTS(name, result_t, params, call)\
+    static result_t name##Baseline params { return call; }\
+    ISA_TARGET_AVX2 static result_t name##Avx2 params { return call; }\
+    ISA_TARGET_AVX512 static result_t name##Avx512 params { return call; }
+
+#define ISA_KERNEL(name) name##Baseline, name##Avx2, name##Avx512
+
+#endif // CPU_DISPATCH_H
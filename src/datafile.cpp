@@ -1,18 +1,368 @@
 #include "datafile.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <exception>
+#include <fstream>
+#include <functional>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef MULTITHREAD
+#include <thread>
+#endif
+
+#include "compressed_stream.hpp"
+#include "text_scanner.hpp"
+#include "text_writer.hpp"
+
+// Every thread parses at least this amount of bytes of a block
+const size_t PARSE_PART_SIZE = 1 << 22;
+
+const size_t READ_BUFFER_SIZE = 1 << 20;
+
+// Amount of chunks read ahead of parsing
+const size_t READ_QUEUE_LENGTH = 4;
+
+// Block header with sizes of the block, test_set one has the most tokens
+const size_t BLOCK_HEADER_TOKENS = 4;
+
+// Every thread formats at least this amount of values of a block at once
+const size_t WRITE_PART_SIZE = 1 << 20;
+
+// Binary data file consists of header, table of blocks and arrays of blocks.
+// Arrays are kept as is in little-endian byte order at offsets aligned to
+// BINARY_ALIGNMENT, so they are used right from mapped file; rows of test
+// sets are packed to bits
+const char BINARY_MAGIC[8] = {'U', 'I', 'M', 'D', 'A', 'T', 'A', '\x1a'};
+const uint32_t BINARY_VERSION = 1;
+const size_t BINARY_ALIGNMENT = 64;
+
+enum class BinaryBlockType : uint32_t
+{
+    LearningSetFeatures = 1,
+    LearningSetPfeatures = 2,
+    RangesMin = 3,
+    RangesMax = 4,
+    Uim = 5,
+    UimWeights = 6,
+    RecognizeSet = 7,
+    TestSet = 8
+};
+
+struct BinaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t blocksCount;
+};
+
+// Key is covering koefficient of test set
+struct BinaryBlock
+{
+    BinaryBlockType type;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t key;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static bool isLittleEndian() {
+    uint16_t value = 1;
+    return *reinterpret_cast<uint8_t*>(&value) == 1;
+}
+
+static bool isBinaryData(const char* data, size_t size) {
+    return size >= sizeof(BINARY_MAGIC) && std::memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+}
+
+static uint64_t getPackedRowSize(uint32_t cols) {
+    return (cols + 7) / 8;
+}
+
+static void forEachPart(size_t partsCount, const std::function<void(size_t)>& body) {
+#ifdef MULTITHREAD
+    if (partsCount > 1) {
+        std::vector<std::thread> threads(partsCount);
+        std::vector<std::exception_ptr> errors(partsCount);
+
+        for (size_t part = 0; part < partsCount; ++part) {
+            threads[part] = std::thread([&body, &errors, part]() {
+                try {
+                    body(part);
+                } catch (...) {
+                    errors[part] = std::current_exception();
+                }
+            });
+        }
 
-feature_t parseNext(std::istream& stream) {
-    std::string temp;
-    stream >> temp;
+        for (auto& thread : threads) {
+            thread.join();
+        }
 
-    if (temp == "-") {
-        return DataFile::DASH;
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        return;
+    }
+#endif
+
+    for (size_t part = 0; part < partsCount; ++part) {
+        body(part);
+    }
+}
+
+static void checkLength(uint32_t& length, uint32_t value, const char* name) {
+    if (length != DataFile::NOT_INITIALIZED && length != value) {
+        throw std::runtime_error(std::string("Invalid data, ") + name + " is not consist in different blocks");
     }
+    length = value;
+}
+
+static void checkValuesCount(size_t count, size_t expectedCount) {
+    if (count != expectedCount) {
+        std::stringstream fmt;
+        fmt << "Cannot parse input, block has " << count
+            << " values instead of " << expectedCount;
+        throw std::runtime_error(fmt.str());
+    }
+}
+
+static void checkBlockEnd(TextScanner& scanner, size_t parsedCount, size_t expectedCount) {
+    auto end = scanner.findHeader();
+    TextScanner rest(scanner.getPosition(), end);
+    checkValuesCount(parsedCount + rest.countTokens(), expectedCount);
 
-    return std::stoul(temp);
+    scanner.setPosition(end);
+}
+
+// Text of chunked input. Chunks are appended to the buffer while the text
+// is parsed and the parsed text is dropped from its start, so pointers to
+// the buffer are valid only until the next read or drop
+class ChunkedText
+{
+public:
+    explicit ChunkedText(ChunkReader& reader)
+        : _reader(reader), _finished(false) { }
+
+    inline const char* begin() const {
+        return _buffer.data();
+    }
+
+    inline const char* end() const {
+        return _buffer.data() + _buffer.size();
+    }
+
+    inline bool isFinished() const {
+        return _finished;
+    }
+
+    inline std::vector<char>& getBuffer() {
+        return _buffer;
+    }
+
+    // Appends the next chunk, returns false at the end of data
+    inline bool read() {
+        _finished = _finished || !_reader.read(_buffer);
+        return !_finished;
+    }
+
+    // Text up to this position consists of whole tokens,
+    // the last token may be continued by the next chunk
+    inline const char* getWholeEnd() const {
+        return _finished ? end() : TextScanner::findTokenStart(begin(), end());
+    }
+
+    inline void drop(const char* position) {
+        _buffer.erase(_buffer.begin(), _buffer.begin() + (position - begin()));
+    }
+
+    // Reads chunks until the text starts with the given amount of whole tokens
+    void readTokens(size_t count) {
+        for (;;) {
+            TextScanner scanner(begin(), getWholeEnd());
+            size_t found = 0;
+            while (found < count && scanner.skipSpaces()) {
+                scanner.nextToken();
+                found += 1;
+            }
+
+            if (found == count || !read()) {
+                return;
+            }
+        }
+    }
+
+    // Reads chunks until the next block header after the scanner position,
+    // the scanner is moved to the new buffer
+    void readHeader(TextScanner& scanner) {
+        size_t offset = scanner.getPosition() - begin();
+
+        // Text before this offset is already searched for the header
+        auto searched = offset;
+        for (;;) {
+            TextScanner rest(begin() + searched, end());
+            if (rest.findHeader() != end()) {
+                break;
+            }
+
+            searched = TextScanner::findTokenStart(begin() + offset, end()) - begin();
+            if (!read()) {
+                break;
+            }
+        }
+
+        scanner = TextScanner(begin() + offset, end());
+    }
+
+private:
+    ChunkReader& _reader;
+    std::vector<char> _buffer;
+    bool _finished;
+};
+
+// Parses body of a block as rowsCount rows, first width1 values of every row
+// go to values1 and the next width2 ones to values2. Body ends at the next
+// block header, so it's split into parts by bytes; token counts of parts are
+// calculated first to know where values of every part are placed
+template<typename T>
+static void parseMatrix(TextScanner& scanner, size_t rowsCount,
+                        size_t width1, T* values1, size_t width2 = 0, T* values2 = nullptr) {
+    auto width = width1 + width2;
+    auto count = rowsCount * width;
+
+    auto begin = scanner.getPosition();
+    auto end = scanner.findHeader();
+    size_t partsCount = 1;
+#ifdef MULTITHREAD
+    partsCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                      (end - begin) / PARSE_PART_SIZE));
+#endif
+
+    auto parsePart = [=](TextScanner& partScanner, size_t first, size_t last) {
+        auto row = width > 0 ? first / width : 0;
+        auto col = width > 0 ? first % width : 0;
+        for (auto k = first; k < last; ++k) {
+            auto value = partScanner.nextValue<T>();
+            if (col < width1) {
+                values1[row * width1 + col] = value;
+            } else {
+                values2[row * width2 + (col - width1)] = value;
+            }
+
+            if (++col == width) {
+                col = 0;
+                row += 1;
+            }
+        }
+    };
+
+    if (partsCount == 1 || width == 0) {
+        parsePart(scanner, 0, count);
+        checkBlockEnd(scanner, count, count);
+        return;
+    }
+
+    std::vector<const char*> bounds(partsCount + 1);
+    for (size_t part = 0; part <= partsCount; ++part) {
+        bounds[part] = TextScanner::alignToToken(begin, begin + (end - begin) * part / partsCount, end);
+    }
+
+    std::vector<size_t> offsets(partsCount + 1, 0);
+    forEachPart(partsCount, [&bounds, &offsets](size_t part) {
+        TextScanner partScanner(bounds[part], bounds[part + 1]);
+        offsets[part + 1] = partScanner.countTokens();
+    });
+
+    for (size_t part = 0; part < partsCount; ++part) {
+        offsets[part + 1] += offsets[part];
+    }
+
+    checkValuesCount(offsets[partsCount], count);
+
+    forEachPart(partsCount, [&bounds, &offsets, &parsePart](size_t part) {
+        TextScanner partScanner(bounds[part], bounds[part + 1]);
+        parsePart(partScanner, offsets[part], offsets[part + 1]);
+    });
+
+    scanner.setPosition(end);
+}
+
+// Formats rowsCount rows, first width1 values of every row are taken from
+// values1 and the next width2 ones from values2, the two parts of a row are
+// separated by an extra space. Large blocks are formatted in rounds, every
+// thread formats its own range of rows and the parts are written in order
+template<typename T>
+static void writeMatrix(TextWriter& writer, bool dashes, size_t rowsCount,
+                        size_t width1, const T* values1, size_t width2 = 0, const T* values2 = nullptr) {
+    auto width = width1 + width2;
+
+    auto writeRows = [=](TextWriter& partWriter, size_t first, size_t last) {
+        for (auto i = first; i < last; ++i) {
+            for (size_t j = 0; j < width1; ++j) {
+                auto value = values1[i * width1 + j];
+                if (dashes && value == std::numeric_limits<T>::max()) {
+                    partWriter.write('-');
+                } else {
+                    partWriter.writeValue(value);
+                }
+                partWriter.write(' ');
+            }
+            if (values2 != nullptr) {
+                partWriter.write(' ');
+                for (size_t j = 0; j < width2; ++j) {
+                    auto value = values2[i * width2 + j];
+                    if (dashes && value == std::numeric_limits<T>::max()) {
+                        partWriter.write('-');
+                    } else {
+                        partWriter.writeValue(value);
+                    }
+                    partWriter.write(' ');
+                }
+            }
+            partWriter.write('\n');
+        }
+    };
+
+    size_t threadsCount = 1;
+#ifdef MULTITHREAD
+    threadsCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+#endif
+    auto partRows = std::max<size_t>(1, WRITE_PART_SIZE / std::max<size_t>(1, width));
+
+    if (threadsCount == 1 || rowsCount <= partRows) {
+        writeRows(writer, 0, rowsCount);
+        return;
+    }
+
+    std::vector<TextWriter> partWriters(threadsCount);
+    for (size_t roundBegin = 0; roundBegin < rowsCount; roundBegin += partRows * threadsCount) {
+        auto partsCount = std::min(threadsCount, (rowsCount - roundBegin + partRows - 1) / partRows);
+
+        forEachPart(partsCount, [&](size_t part) {
+            auto first = roundBegin + part * partRows;
+            partWriters[part].clear();
+            writeRows(partWriters[part], first, std::min(rowsCount, first + partRows));
+        });
+
+        for (size_t part = 0; part < partsCount; ++part) {
+            writer.write(partWriters[part]);
+        }
+    }
 }
 
 TestSet::TestSet():
@@ -54,7 +404,12 @@ DataFile::DataFile():
     _rangesMax(nullptr),
     _uimSet(nullptr),
     _uimWeights(nullptr),
-    _recognizeSetFeatures(nullptr) { }
+    _recognizeSetFeatures(nullptr),
+    _binary(false),
+    _mappingSize(0),
+    _parsedBlocks(AllBlocks),
+    _learningSetConsumer(nullptr),
+    _chunkedText(nullptr) { }
 
 DataFile::~DataFile() {
     reset();
@@ -63,57 +418,728 @@ DataFile::~DataFile() {
 void DataFile::load(std::istream& inputStream) {
     reset();
 
+    StreamChunkReader streamReader(inputStream, READ_BUFFER_SIZE);
+    if (inputStream.peek() == 0x1f) {
+        GzipChunkReader gzipReader(streamReader, READ_BUFFER_SIZE);
+        loadChunks(gzipReader);
+    } else {
+        loadChunks(streamReader);
+    }
+}
+
+void DataFile::load(const std::string& path) {
+    reset();
+
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open input file " + path);
+    }
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        // Pages are copied on write, so mapped arrays can be changed as usual ones
+        data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    // Pipes and special files can't be mapped
+    if (data == MAP_FAILED) {
+        std::ifstream inputStream(path);
+        load(inputStream);
+        return;
+    }
+
+    auto begin = static_cast<const char*>(data);
+    size_t size = info.st_size;
+    _mapping.reset(begin, [size](const char* data) { munmap(const_cast<char*>(data), size); });
+    _mappingSize = size;
+
+    if (isGzipData(begin, size)) {
+        madvise(data, size, MADV_SEQUENTIAL);
+        auto mapping = _mapping;
+        _mapping.reset();
+        _mappingSize = 0;
+
+        MemoryChunkReader memoryReader(begin, begin + size, READ_BUFFER_SIZE);
+        GzipChunkReader gzipReader(memoryReader, READ_BUFFER_SIZE);
+        loadChunks(gzipReader);
+        return;
+    }
+
+    _mappedFiles.push_back(std::make_pair(static_cast<uint64_t>(info.st_dev),
+                                          static_cast<uint64_t>(info.st_ino)));
+
+    _binary = isBinaryData(begin, size);
+    if (_binary) {
+        loadBinary(begin, begin + size);
+    } else {
+        madvise(data, size, MADV_WILLNEED);
+        loadText(begin, begin + size, _mapping);
+
+        // Text is parsed to separate arrays, only raw blocks refer to it
+        _mapping.reset();
+        _mappingSize = 0;
+    }
+}
+
+// Rows of parsed blocks are parsed as soon as their chunks arrive, while
+// the next chunks are read and decompressed by background thread. Parsed
+// text is dropped, so only the current chunk is kept in memory besides
+// arrays of the blocks. Text of blocks which aren't parsed is kept whole
+void DataFile::loadChunks(ChunkReader& source) {
+#ifdef MULTITHREAD
+    ThreadedChunkReader reader(source, READ_QUEUE_LENGTH);
+#else
+    ChunkReader& reader = source;
+#endif
+
+    ChunkedText text(reader);
+    while (static_cast<size_t>(text.end() - text.begin()) < sizeof(BINARY_MAGIC) && text.read()) { }
+
+    _binary = isBinaryData(text.begin(), text.end() - text.begin());
+    if (_binary) {
+        while (text.read()) { }
+
+        // Arrays of binary data point to the buffer, so it's kept until reset
+        auto data = std::make_shared<std::vector<char>>(std::move(text.getBuffer()));
+        _mapping = std::shared_ptr<const char>(data, data->data());
+        _mappingSize = data->size();
+        loadBinary(data->data(), data->data() + data->size());
+        return;
+    }
+
+    _chunkedText = &text;
+    try {
+        for (;;) {
+            // Header of the block with its sizes should be read completely
+            text.readTokens(BLOCK_HEADER_TOKENS);
+
+            TextScanner scanner(text.begin(), text.end());
+            if (!loadTextBlock(scanner, nullptr)) {
+                break;
+            }
+
+            text.drop(scanner.getPosition());
+        }
+    } catch (...) {
+        _chunkedText = nullptr;
+        throw;
+    }
+    _chunkedText = nullptr;
+
+    calc();
+}
+
+void DataFile::loadText(const char* begin, const char* end, const std::shared_ptr<const char>& text) {
+    TextScanner scanner(begin, end);
+    while (loadTextBlock(scanner, text)) { }
+
+    calc();
+}
+
+bool DataFile::loadTextBlock(TextScanner& scanner, const std::shared_ptr<const char>& text) {
+    scanner.skipSpaces();
+    auto blockBegin = scanner.getPosition();
+    auto header = scanner.nextToken();
+
+    Block block;
+    if (header.empty()) {
+        return false;
+    } else if (header == "info:") {
+        return false;
+    } else if (header == "learning_set:") {
+        block = LearningSetBlock;
+    } else if (header == "ranges:") {
+        block = RangesBlock;
+    } else if (header == "uim:") {
+        block = UimBlock;
+    } else if (header == "uim_weights:") {
+        block = UimWeightsBlock;
+    } else if (header == "recognize_set:") {
+        block = RecognizeSetBlock;
+    } else if (header == "test_set:") {
+        block = TestSetBlock;
+    } else {
+        std::stringstream fmt;
+        fmt << "Cannot parse input_stream, unknown block " << header;
+        throw std::runtime_error(fmt.str());
+    }
+
+    feature_size_t key = 0;
+    if (block == TestSetBlock) {
+        TextScanner keyScanner = scanner;
+        key = keyScanner.nextValue<feature_size_t>();
+    }
+
+    // Consumed rows of learning set aren't kept, so it can't be copied
+    auto consumed = block == LearningSetBlock && _learningSetConsumer != nullptr;
+    auto parsed = consumed || (_parsedBlocks & block) != 0;
+
+    // Text of skipped blocks is copied, so it's read up to the next header
+    if (_chunkedText != nullptr && !parsed) {
+        size_t offset = blockBegin - _chunkedText->begin();
+        _chunkedText->readHeader(scanner);
+        blockBegin = _chunkedText->begin() + offset;
+    }
+
+    if (parsed) {
+        readBlock(scanner, block);
+    } else {
+        skipBlock(scanner, block);
+    }
+
+    // Stream isn't kept after load, so only text of the blocks
+    // which aren't parsed is copied from it
+    if (!consumed && (!parsed || text)) {
+        addRawBlock(block, key, blockBegin, scanner.getPosition(), text);
+    }
+    return true;
+}
+
+void DataFile::readBlock(TextScanner& scanner, Block block) {
+    switch (block) {
+    case LearningSetBlock:
+        readLearningSetBlock(scanner);
+        break;
+    case RangesBlock:
+        readRangesBlock(scanner);
+        break;
+    case UimBlock:
+        readUimBlock(scanner);
+        break;
+    case UimWeightsBlock:
+        readUimWeightsBlock(scanner);
+        break;
+    case RecognizeSetBlock:
+        readRecognizeSetBlock(scanner);
+        break;
+    case TestSetBlock:
+        readTestSetBlock(scanner);
+        break;
+    default:
+        break;
+    }
+}
+
+// Parses rowsCount rows of width values one by one. Chunked text is read
+// while the rows are parsed, it's parsed up to the last whole token of
+// the buffer, so only the current chunk of the block is kept in memory
+template<typename T>
+void DataFile::readRows(TextScanner& scanner, size_t rowsCount, size_t width,
+                        const std::function<void(const T*)>& consume) {
+    std::vector<T> row(width);
+    auto count = rowsCount * width;
+
+    if (_chunkedText == nullptr || width == 0) {
+        for (size_t i = 0; i < rowsCount; ++i) {
+            for (size_t j = 0; j < width; ++j) {
+                row[j] = scanner.nextValue<T>();
+            }
+            consume(row.data());
+        }
+
+        if (_chunkedText == nullptr) {
+            checkBlockEnd(scanner, count, count);
+            return;
+        }
+    }
+
+    // Values are parsed up to the next header, then the rest of tokens
+    // before it is counted to report the actual size of the block
+    size_t parsedCount = 0;
+    size_t extraCount = 0;
+    size_t col = 0;
     for (;;) {
-        std::string header;
+        auto wholeEnd = _chunkedText->getWholeEnd();
+        TextScanner available(scanner.getPosition(), wholeEnd);
+        auto end = available.findHeader();
+
+        TextScanner part(scanner.getPosition(), end);
+        while (parsedCount < count && part.skipSpaces()) {
+            row[col] = part.nextValue<T>();
+            parsedCount += 1;
+            if (++col == width) {
+                consume(row.data());
+                col = 0;
+            }
+        }
+        extraCount += part.countTokens();
+        scanner.setPosition(end);
 
-        if (!(inputStream >> header)) {
+        if (end != wholeEnd || _chunkedText->isFinished()) {
             break;
-        } else if (header == "info:") {
+        }
+
+        _chunkedText->drop(scanner.getPosition());
+        _chunkedText->read();
+        scanner = TextScanner(_chunkedText->begin(), _chunkedText->end());
+    }
+
+    checkValuesCount(parsedCount + extraCount, count);
+}
+
+// Parses body of a block as rowsCount rows, first width1 values of every
+// row go to values1 and the next width2 ones to values2
+template<typename T>
+void DataFile::readMatrix(TextScanner& scanner, size_t rowsCount,
+                          size_t width1, T* values1, size_t width2, T* values2) {
+    if (_chunkedText == nullptr) {
+        parseMatrix(scanner, rowsCount, width1, values1, width2, values2);
+        return;
+    }
+
+    size_t row = 0;
+    readRows<T>(scanner, rowsCount, width1 + width2,
+                [&row, width1, values1, width2, values2](const T* values) {
+                    std::copy(values, values + width1, values1 + row * width1);
+                    if (width2 > 0) {
+                        std::copy(values + width1, values + width1 + width2, values2 + row * width2);
+                    }
+                    row += 1;
+                });
+}
+
+// Only sizes in the header of a block are read, its body is skipped
+// up to the next header
+void DataFile::skipBlock(TextScanner& scanner, Block block) {
+    switch (block) {
+    case LearningSetBlock:
+        checkLength(_learningSetLen, scanner.nextValue<set_size_t>(), "learningSetLength");
+        checkLength(_featuresLen, scanner.nextValue<feature_size_t>(), "featuresLength");
+        checkLength(_pfeaturesLen, scanner.nextValue<feature_size_t>(), "pfeaturesLength");
+        break;
+    case RangesBlock:
+    case UimWeightsBlock:
+        checkLength(_featuresLen, scanner.nextValue<feature_size_t>(), "featuresLength");
+        break;
+    case UimBlock:
+        checkLength(_uimSetLen, scanner.nextValue<set_size_t>(), "uimSetLen");
+        checkLength(_featuresLen, scanner.nextValue<feature_size_t>(), "featuresLength");
+        break;
+    case RecognizeSetBlock:
+        checkLength(_recognizeSetLen, scanner.nextValue<set_size_t>(), "recognizeSetLength");
+        checkLength(_featuresLen, scanner.nextValue<feature_size_t>(), "featuresLength");
+        break;
+    case TestSetBlock:
+        scanner.nextValue<feature_size_t>();
+        scanner.nextValue<set_size_t>();
+        checkLength(_featuresLen, scanner.nextValue<feature_size_t>(), "featuresLength");
+        break;
+    default:
+        break;
+    }
+
+    scanner.setPosition(scanner.findHeader());
+}
+
+// Blocks which were skipped on load are parsed from their text
+void DataFile::parseRawBlocks() {
+    auto consumer = _learningSetConsumer;
+    _learningSetConsumer = nullptr;
+
+    auto rawBlocks = _rawBlocks;
+    for (auto& rawBlock : rawBlocks) {
+        auto isParsed = false;
+        switch (rawBlock.block) {
+        case LearningSetBlock:
+            isParsed = _learningSetFeatures != nullptr;
             break;
-        } else if (header == "learning_set:") {
-            readLearningSetBlock(inputStream);
-        } else if (header == "ranges:") {
-            readRangesBlock(inputStream);
-        } else if (header == "uim:") {
-            readUimBlock(inputStream);
-        } else if (header == "uim_weights:") {
-            readUimWeightsBlock(inputStream);
-        } else if (header == "recognize_set:") {
-            readRecognizeSetBlock(inputStream);
-        } else if (header == "test_set:") {
-            readTestSetBlock(inputStream);
-        } else {
+        case RangesBlock:
+            isParsed = _rangesMin != nullptr && !_rangesCalculated;
+            break;
+        case UimBlock:
+            isParsed = _uimSet != nullptr;
+            break;
+        case UimWeightsBlock:
+            isParsed = _uimWeights != nullptr;
+            break;
+        case RecognizeSetBlock:
+            isParsed = _recognizeSetFeatures != nullptr;
+            break;
+        case TestSetBlock:
+            isParsed = _testSets.find(rawBlock.key) != _testSets.end();
+            break;
+        default:
+            break;
+        }
+
+        if (!isParsed) {
+            TextScanner scanner(rawBlock.begin, rawBlock.end);
+            scanner.nextToken();
+            readBlock(scanner, rawBlock.block);
+
+            // Block isn't changed by parsing, so its text is still valid
+            addRawBlock(rawBlock.block, rawBlock.key, rawBlock.begin, rawBlock.end, rawBlock.text);
+        }
+    }
+
+    _learningSetConsumer = consumer;
+}
+
+void DataFile::addRawBlock(Block block, feature_size_t key, const char* begin, const char* end,
+                           const std::shared_ptr<const char>& text) {
+    RawBlock rawBlock = {block, key, begin, end, text};
+    if (!text) {
+        auto copy = std::make_shared<std::vector<char>>(begin, end);
+        rawBlock.begin = copy->data();
+        rawBlock.end = copy->data() + copy->size();
+        rawBlock.text = std::shared_ptr<const char>(copy, copy->data());
+    }
+
+    dropRawBlock(block, key);
+    _rawBlocks.push_back(rawBlock);
+}
+
+const DataFile::RawBlock* DataFile::findRawBlock(Block block, feature_size_t key) const {
+    for (auto& rawBlock : _rawBlocks) {
+        if (rawBlock.block == block && (block != TestSetBlock || rawBlock.key == key)) {
+            return &rawBlock;
+        }
+    }
+    return nullptr;
+}
+
+void DataFile::dropRawBlock(Block block, feature_size_t key) {
+    _rawBlocks.erase(std::remove_if(_rawBlocks.begin(), _rawBlocks.end(),
+                                    [block, key](const RawBlock& rawBlock) {
+                                        return rawBlock.block == block &&
+                                               (block != TestSetBlock || rawBlock.key == key);
+                                    }),
+                     _rawBlocks.end());
+}
+
+void DataFile::writeRawBlock(TextWriter& writer, const RawBlock& rawBlock) {
+    writer.write(rawBlock.begin, rawBlock.end - rawBlock.begin);
+    if (rawBlock.end[-1] != '\n') {
+        writer.write('\n');
+    }
+}
+
+void DataFile::loadBinary(const char* begin, const char* end) {
+    if (!isLittleEndian()) {
+        throw std::runtime_error("Binary data files are supported on little-endian machines only");
+    }
+
+    size_t size = end - begin;
+    BinaryHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error("Cannot parse input, binary data file is truncated");
+    }
+    std::memcpy(&header, begin, sizeof(header));
+
+    if (header.version != BINARY_VERSION) {
+        std::stringstream fmt;
+        fmt << "Cannot parse input, unsupported version " << header.version << " of binary data file";
+        throw std::runtime_error(fmt.str());
+    }
+    if (sizeof(header) + static_cast<uint64_t>(header.blocksCount) * sizeof(BinaryBlock) > size) {
+        throw std::runtime_error("Cannot parse input, binary data file is truncated");
+    }
+
+    // Parts of learning set and ranges may go in any order
+    BinaryBlock learningSetBlock = {}, pfeaturesBlock = {};
+    feature_t* learningSetFeatures = nullptr;
+    feature_t* learningSetPfeatures = nullptr;
+    feature_t* rangesMin = nullptr;
+    feature_t* rangesMax = nullptr;
+    uint32_t rangesLen = 0;
+
+    for (uint32_t i = 0; i < header.blocksCount; ++i) {
+        BinaryBlock block;
+        std::memcpy(&block, begin + sizeof(header) + i * sizeof(block), sizeof(block));
+
+        auto items = static_cast<uint64_t>(block.rows) * block.cols;
+        uint64_t expectedSize;
+        switch (block.type) {
+        case BinaryBlockType::UimWeights:
+            expectedSize = items * sizeof(weight_t);
+            break;
+        case BinaryBlockType::TestSet:
+            expectedSize = block.rows * getPackedRowSize(block.cols);
+            break;
+        default:
+            expectedSize = items * sizeof(feature_t);
+            break;
+        }
+
+        if (block.offset % BINARY_ALIGNMENT != 0 || block.offset > size ||
+            block.size > size - block.offset || block.size != expectedSize) {
+            throw std::runtime_error("Cannot parse input, broken block table of binary data file");
+        }
+
+        auto data = const_cast<char*>(begin + block.offset);
+        auto features = reinterpret_cast<feature_t*>(data);
+
+        switch (block.type) {
+        case BinaryBlockType::LearningSetFeatures:
+            learningSetBlock = block;
+            learningSetFeatures = features;
+            break;
+        case BinaryBlockType::LearningSetPfeatures:
+            pfeaturesBlock = block;
+            learningSetPfeatures = features;
+            break;
+        case BinaryBlockType::RangesMin:
+            rangesMin = features;
+            rangesLen = block.cols;
+            break;
+        case BinaryBlockType::RangesMax:
+            rangesMax = features;
+            rangesLen = block.cols;
+            break;
+        case BinaryBlockType::Uim:
+            setUimBlock(features, block.rows, block.cols);
+            break;
+        case BinaryBlockType::UimWeights:
+            setUimWeightsBlock(reinterpret_cast<weight_t*>(data), block.cols);
+            break;
+        case BinaryBlockType::RecognizeSet:
+            setRecognizeSetBlock(features, block.rows, block.cols);
+            break;
+        case BinaryBlockType::TestSet: {
+            auto rowSize = getPackedRowSize(block.cols);
+            auto packed = reinterpret_cast<const uint8_t*>(data);
+            feature_t* testSetFeatures = new feature_t[items];
+
+            for (size_t r = 0; r < block.rows; ++r) {
+                for (size_t j = 0; j < block.cols; ++j) {
+                    testSetFeatures[r * block.cols + j] = (packed[r * rowSize + j / 8] >> (j % 8)) & 1;
+                }
+            }
+
+            setTestSetBlock(testSetFeatures, block.key, block.rows, block.cols);
+            break;
+        }
+        default: {
             std::stringstream fmt;
-            fmt << "Cannot parse input_stream, unknown block " << header;
+            fmt << "Cannot parse input, unknown block " << static_cast<uint32_t>(block.type) << " of binary data file";
             throw std::runtime_error(fmt.str());
         }
+        }
+    }
+
+    if ((learningSetFeatures == nullptr) != (learningSetPfeatures == nullptr) ||
+        learningSetBlock.rows != pfeaturesBlock.rows) {
+        throw std::runtime_error("Cannot parse input, learning set of binary data file is incomplete");
+    }
+    if ((rangesMin == nullptr) != (rangesMax == nullptr)) {
+        throw std::runtime_error("Cannot parse input, ranges of binary data file are incomplete");
+    }
+
+    if (learningSetFeatures != nullptr && _learningSetConsumer != nullptr) {
+        _learningSetConsumer->begin(learningSetBlock.rows, learningSetBlock.cols, pfeaturesBlock.cols);
+        for (size_t i = 0; i < learningSetBlock.rows; ++i) {
+            _learningSetConsumer->consume(learningSetFeatures + i * learningSetBlock.cols,
+                                          learningSetPfeatures + i * pfeaturesBlock.cols);
+        }
+        _learningSetConsumer->end();
+
+        _learningSetLen = learningSetBlock.rows;
+        _featuresLen = learningSetBlock.cols;
+        _pfeaturesLen = pfeaturesBlock.cols;
+    } else if (learningSetFeatures != nullptr) {
+        setLearningSetBlock(learningSetFeatures,
+                            learningSetPfeatures,
+                            learningSetBlock.rows,
+                            learningSetBlock.cols,
+                            pfeaturesBlock.cols);
+    }
+
+    if (rangesMin != nullptr) {
+        setRangesBlock(rangesMin, rangesMax, rangesLen);
     }
 
     calc();
 }
 
+void DataFile::save(const std::string& path) {
+    // Arrays and raw blocks may refer to mapped input file, so it's replaced
+    // by a new file instead of being truncated under the mapping
+    struct stat info;
+    auto replaced = false;
+    if (stat(path.c_str(), &info) == 0) {
+        auto file = std::make_pair(static_cast<uint64_t>(info.st_dev), static_cast<uint64_t>(info.st_ino));
+        replaced = std::find(_mappedFiles.begin(), _mappedFiles.end(), file) != _mappedFiles.end();
+    }
+    auto outputPath = replaced ? path + "." + std::to_string(getpid()) + ".tmp" : path;
+
+    try {
+        std::ofstream outputStream(outputPath, std::ios::binary);
+        if (!outputStream) {
+            throw std::runtime_error("Cannot open output file " + outputPath);
+        }
+
+        if (isGzipPath(path)) {
+            GzipOutputStream gzipStream(outputStream);
+            save(gzipStream);
+            gzipStream.finish();
+        } else {
+            save(outputStream);
+        }
+
+        // Failed write must not replace input file, errors of buffered data
+        // are reported only on closing
+        outputStream.close();
+        if (!outputStream) {
+            throw std::runtime_error("Cannot write output file " + outputPath);
+        }
+    } catch (...) {
+        if (replaced) {
+            std::remove(outputPath.c_str());
+        }
+        throw;
+    }
+
+    if (replaced && std::rename(outputPath.c_str(), path.c_str()) != 0) {
+        std::remove(outputPath.c_str());
+        throw std::runtime_error("Cannot replace output file " + path);
+    }
+}
+
 void DataFile::save(std::ostream& outputStream) {
+    if (_binary) {
+        saveBinary(outputStream);
+    } else {
+        saveText(outputStream);
+    }
+}
+
+void DataFile::saveBinary(std::ostream& outputStream) {
+    if (!isLittleEndian()) {
+        throw std::runtime_error("Binary data files are supported on little-endian machines only");
+    }
+
+    // Text of blocks can't be copied to binary output
+    parseRawBlocks();
+
+    std::vector<BinaryBlock> blocks;
+    std::vector<const char*> arrays;
+    std::vector<std::vector<uint8_t>> packedTestSets;
+
+    auto addBlock = [&blocks, &arrays](BinaryBlockType type, uint32_t rows, uint32_t cols, uint32_t key,
+                                       const void* data, uint64_t size) {
+        BinaryBlock block = {type, rows, cols, key, 0, size};
+        blocks.push_back(block);
+        arrays.push_back(static_cast<const char*>(data));
+    };
+
     if (_learningSetFeatures != nullptr) {
-        writeLearningSetBlock(outputStream);
+        addBlock(BinaryBlockType::LearningSetFeatures, _learningSetLen, _featuresLen, 0, _learningSetFeatures,
+                 static_cast<uint64_t>(_learningSetLen) * _featuresLen * sizeof(feature_t));
+        addBlock(BinaryBlockType::LearningSetPfeatures, _learningSetLen, _pfeaturesLen, 0, _learningSetPfeatures,
+                 static_cast<uint64_t>(_learningSetLen) * _pfeaturesLen * sizeof(feature_t));
     }
 
     if (_rangesMin != nullptr && !_rangesCalculated) {
-        writeRangesBlock(outputStream);
+        addBlock(BinaryBlockType::RangesMin, 1, _featuresLen, 0, _rangesMin, _featuresLen * sizeof(feature_t));
+        addBlock(BinaryBlockType::RangesMax, 1, _featuresLen, 0, _rangesMax, _featuresLen * sizeof(feature_t));
     }
 
     if (_uimSet != nullptr) {
-        writeUimBlock(outputStream);
+        addBlock(BinaryBlockType::Uim, _uimSetLen, _featuresLen, 0, _uimSet,
+                 static_cast<uint64_t>(_uimSetLen) * _featuresLen * sizeof(feature_t));
     }
 
     if (_uimWeights != nullptr) {
-        writeUimWeightsBlock(outputStream);
+        addBlock(BinaryBlockType::UimWeights, 1, _featuresLen, 0, _uimWeights, _featuresLen * sizeof(weight_t));
     }
 
     if (_recognizeSetFeatures != nullptr) {
-        writeRecognizeSetBlock(outputStream);
+        addBlock(BinaryBlockType::RecognizeSet, _recognizeSetLen, _featuresLen, 0, _recognizeSetFeatures,
+                 static_cast<uint64_t>(_recognizeSetLen) * _featuresLen * sizeof(feature_t));
+    }
+
+    packedTestSets.reserve(_testSets.size());
+    for (auto const & kv : _testSets) {
+        auto rowSize = getPackedRowSize(_featuresLen);
+        packedTestSets.push_back(std::vector<uint8_t>(kv.second.getLen() * rowSize, 0));
+        auto& packed = packedTestSets.back();
+
+        for (size_t i = 0; i < kv.second.getLen(); ++i) {
+            for (size_t j = 0; j < _featuresLen; ++j) {
+                auto value = kv.second.get(_featuresLen * i + j);
+                if (value > 1) {
+                    throw std::runtime_error("Cannot save test set with non binary values to binary data file");
+                }
+                packed[i * rowSize + j / 8] |= value << (j % 8);
+            }
+        }
+
+        addBlock(BinaryBlockType::TestSet, kv.second.getLen(), _featuresLen, kv.first, packed.data(), packed.size());
+    }
+
+    BinaryHeader header;
+    std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version = BINARY_VERSION;
+    header.blocksCount = blocks.size();
+
+    auto offset = alignOffset(sizeof(header) + blocks.size() * sizeof(BinaryBlock));
+    for (auto& block : blocks) {
+        block.offset = offset;
+        offset = alignOffset(offset + block.size);
+    }
+
+    outputStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outputStream.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(BinaryBlock));
+
+    uint64_t position = sizeof(header) + blocks.size() * sizeof(BinaryBlock);
+    const char padding[BINARY_ALIGNMENT] = {};
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        outputStream.write(padding, blocks[i].offset - position);
+        outputStream.write(arrays[i], blocks[i].size);
+        position = blocks[i].offset + blocks[i].size;
+    }
+}
+
+void DataFile::saveText(std::ostream& outputStream) {
+    TextWriter writer(&outputStream);
+
+    if (auto rawBlock = findRawBlock(LearningSetBlock)) {
+        writeRawBlock(writer, *rawBlock);
+    } else if (_learningSetFeatures != nullptr) {
+        writeLearningSetBlock(writer);
+    }
+
+    if (auto rawBlock = findRawBlock(RangesBlock)) {
+        writeRawBlock(writer, *rawBlock);
+    } else if (_rangesMin != nullptr && !_rangesCalculated) {
+        writeRangesBlock(writer);
+    }
+
+    if (auto rawBlock = findRawBlock(UimBlock)) {
+        writeRawBlock(writer, *rawBlock);
+    } else if (_uimSet != nullptr) {
+        writeUimBlock(writer);
+    }
+
+    if (auto rawBlock = findRawBlock(UimWeightsBlock)) {
+        writeRawBlock(writer, *rawBlock);
+    } else if (_uimWeights != nullptr) {
+        writeUimWeightsBlock(writer);
+    }
+
+    if (auto rawBlock = findRawBlock(RecognizeSetBlock)) {
+        writeRawBlock(writer, *rawBlock);
+    } else if (_recognizeSetFeatures != nullptr) {
+        writeRecognizeSetBlock(writer);
     }
 
-    writeTestSetBlock(outputStream);
+    writeTestSetBlock(writer);
+
+    writer.flush();
+    outputStream.flush();
+}
+
+template<typename T>
+void DataFile::releaseArray(T*& array) {
+    auto data = reinterpret_cast<const char*>(array);
+    auto isMapped = _mapping && data >= _mapping.get() && data < _mapping.get() + _mappingSize;
+
+    if (array != nullptr && !isMapped) {
+        delete [] array;
+    }
+    array = nullptr;
 }
 
 void DataFile::reset() {
@@ -124,44 +1150,30 @@ void DataFile::reset() {
     _recognizeSetLen = NOT_INITIALIZED;
     _rangesCalculated = false;
 
-    if (_learningSetFeatures != nullptr) {
-        delete [] _learningSetFeatures;
-        _learningSetFeatures = nullptr;
-    }
+    releaseArray(_learningSetFeatures);
 
-    if (_learningSetPfeatures != nullptr) {
-        delete [] _learningSetPfeatures;
-        _learningSetPfeatures = nullptr;
-    }
+    releaseArray(_learningSetPfeatures);
 
-    if (_rangesMin != nullptr) {
-        delete [] _rangesMin;
-        _rangesMin = nullptr;
-    }
+    releaseArray(_rangesMin);
 
-    if (_rangesMax != nullptr) {
-        delete [] _rangesMax;
-        _rangesMax = nullptr;
-    }
+    releaseArray(_rangesMax);
 
-    if (_uimSet != nullptr) {
-        delete [] _uimSet;
-        _uimSet = nullptr;
-    }
+    releaseArray(_uimSet);
 
-    if (_uimWeights != nullptr) {
-        delete [] _uimWeights;
-        _uimWeights = nullptr;
-    }
+    releaseArray(_uimWeights);
 
-    if (_recognizeSetFeatures != nullptr) {
-        delete [] _recognizeSetFeatures;
-        _recognizeSetFeatures = nullptr;
-    }
+    releaseArray(_recognizeSetFeatures);
+
+    _mapping.reset();
+    _mappingSize = 0;
+
+    _rawBlocks.clear();
+    _mappedFiles.clear();
+    _chunkedText = nullptr;
 }
 
 void DataFile::calc() {
-    if (_learningSetLen > 0) {
+    if (_learningSetFeatures != nullptr && _learningSetLen > 0) {
         if (_rangesMin == nullptr) {
             _rangesMin = new feature_t[_featuresLen];
             _rangesCalculated = true;
@@ -170,7 +1182,7 @@ void DataFile::calc() {
                 _rangesMin[j] = std::numeric_limits<feature_t>::max();
             }
 
-            for (auto i=0; i<_learningSetLen; ++i) {
+            for (size_t i=0; i<_learningSetLen; ++i) {
                 for (auto j=0; j<_featuresLen; ++j) {
                     if (_learningSetFeatures[i*_featuresLen + j] != DASH &&
                         _learningSetFeatures[i*_featuresLen + j] < _rangesMin[j]) {
@@ -188,7 +1200,7 @@ void DataFile::calc() {
                 _rangesMax[j] = std::numeric_limits<feature_t>::min();
             }
 
-            for (auto i=0; i<_learningSetLen; ++i) {
+            for (size_t i=0; i<_learningSetLen; ++i) {
                 for (auto j=0; j<_featuresLen; ++j) {
                     if (_learningSetFeatures[i*_featuresLen + j] != DASH &&
                         _learningSetFeatures[i*_featuresLen + j] > _rangesMax[j]) {
@@ -200,6 +1212,68 @@ void DataFile::calc() {
     }
 }
 
+void DataFile::transfer(const DataFile& source) {
+    if (source._learningSetFeatures != nullptr) {
+        auto featuresSize = static_cast<size_t>(source._learningSetLen) * source._featuresLen;
+        auto pfeaturesSize = static_cast<size_t>(source._learningSetLen) * source._pfeaturesLen;
+
+        feature_t* learningSetFeatures = new feature_t[featuresSize];
+        feature_t* learningSetPfeatures = new feature_t[pfeaturesSize];
+        std::copy(source._learningSetFeatures, source._learningSetFeatures + featuresSize, learningSetFeatures);
+        std::copy(source._learningSetPfeatures, source._learningSetPfeatures + pfeaturesSize, learningSetPfeatures);
+
+        setLearningSetBlock(learningSetFeatures,
+                            learningSetPfeatures,
+                            source._learningSetLen,
+                            source._featuresLen,
+                            source._pfeaturesLen);
+    }
+
+    if (source._rangesMin != nullptr && !source._rangesCalculated) {
+        feature_t* rangesMin = new feature_t[source._featuresLen];
+        feature_t* rangesMax = new feature_t[source._featuresLen];
+        std::copy(source._rangesMin, source._rangesMin + source._featuresLen, rangesMin);
+        std::copy(source._rangesMax, source._rangesMax + source._featuresLen, rangesMax);
+
+        setRangesBlock(rangesMin,
+                       rangesMax,
+                       source._featuresLen);
+    }
+
+    if (source._recognizeSetFeatures != nullptr) {
+        auto size = static_cast<size_t>(source._recognizeSetLen) * source._featuresLen;
+
+        feature_t* recognizeSetFeatures = new feature_t[size];
+        std::copy(source._recognizeSetFeatures, source._recognizeSetFeatures + size, recognizeSetFeatures);
+
+        setRecognizeSetBlock(recognizeSetFeatures,
+                             source._recognizeSetLen,
+                             source._featuresLen);
+    }
+
+    // Blocks which weren't parsed are transferred as text
+    auto transferred = false;
+    for (auto& rawBlock : source._rawBlocks) {
+        if (rawBlock.block == LearningSetBlock) {
+            checkLength(_learningSetLen, source._learningSetLen, "learningSetLength");
+            checkLength(_pfeaturesLen, source._pfeaturesLen, "pfeaturesLength");
+        } else if (rawBlock.block == RecognizeSetBlock) {
+            checkLength(_recognizeSetLen, source._recognizeSetLen, "recognizeSetLength");
+        } else if (rawBlock.block != RangesBlock) {
+            continue;
+        }
+
+        checkLength(_featuresLen, source._featuresLen, "featuresLength");
+        addRawBlock(rawBlock.block, rawBlock.key, rawBlock.begin, rawBlock.end, rawBlock.text);
+        transferred = true;
+    }
+
+    // Text of transferred blocks may be in mapped files of the source
+    if (transferred) {
+        _mappedFiles.insert(_mappedFiles.end(), source._mappedFiles.begin(), source._mappedFiles.end());
+    }
+}
+
 void DataFile::setLearningSetBlock(uint32_t* learningSetFeatures,
                                    uint32_t* learningSetPfeatures,
                                    uint32_t learningSetLen,
@@ -215,12 +1289,9 @@ void DataFile::setLearningSetBlock(uint32_t* learningSetFeatures,
     if (_pfeaturesLen != DASH && _pfeaturesLen != pfeaturesLen) {
         throw std::runtime_error("Invalid data, pfeaturesLength is not consist in different blocks");
     }
-    if (_learningSetFeatures != nullptr) {
-        delete [] _learningSetFeatures;
-    }
-    if (_learningSetPfeatures != nullptr) {
-        delete [] _learningSetPfeatures;
-    }
+    releaseArray(_learningSetFeatures);
+    releaseArray(_learningSetPfeatures);
+    dropRawBlock(LearningSetBlock);
 
     _learningSetLen = learningSetLen;
     _featuresLen = featuresLen;
@@ -229,22 +1300,32 @@ void DataFile::setLearningSetBlock(uint32_t* learningSetFeatures,
     _learningSetPfeatures = learningSetPfeatures;
 }
 
-void DataFile::readLearningSetBlock(std::istream& inputStream) {
-    set_size_t learningSetLen;
-    feature_size_t featuresLen, pfeaturesLen;
-    inputStream >> learningSetLen >> featuresLen >> pfeaturesLen;
+void DataFile::readLearningSetBlock(TextScanner& scanner) {
+    auto learningSetLen = scanner.nextValue<set_size_t>();
+    auto featuresLen = scanner.nextValue<feature_size_t>();
+    auto pfeaturesLen = scanner.nextValue<feature_size_t>();
+
+    if (_learningSetConsumer != nullptr) {
+        auto consumer = _learningSetConsumer;
+        consumer->begin(learningSetLen, featuresLen, pfeaturesLen);
+        readRows<feature_t>(scanner, learningSetLen, featuresLen + pfeaturesLen,
+                            [consumer, featuresLen](const feature_t* row) {
+                                consumer->consume(row, row + featuresLen);
+                            });
+        consumer->end();
+
+        _learningSetLen = learningSetLen;
+        _featuresLen = featuresLen;
+        _pfeaturesLen = pfeaturesLen;
+        return;
+    }
 
-    feature_t* learningSetFeatures = new feature_t[learningSetLen * featuresLen];
-    feature_t* learningSetPfeatures = new feature_t[learningSetLen * pfeaturesLen];
+    feature_t* learningSetFeatures = new feature_t[static_cast<size_t>(learningSetLen) * featuresLen];
+    feature_t* learningSetPfeatures = new feature_t[static_cast<size_t>(learningSetLen) * pfeaturesLen];
 
-    for (auto i = 0; i < learningSetLen; ++i) {
-        for (auto j = 0; j < featuresLen; ++j) {
-            learningSetFeatures[featuresLen * i + j] = parseNext(inputStream);
-        }
-        for (auto j = 0; j < pfeaturesLen; ++j) {
-            learningSetPfeatures[pfeaturesLen * i + j] = parseNext(inputStream);
-        }
-    }
+    readMatrix(scanner, learningSetLen,
+               featuresLen, learningSetFeatures,
+               pfeaturesLen, learningSetPfeatures);
 
     setLearningSetBlock(learningSetFeatures,
                         learningSetPfeatures,
@@ -253,34 +1334,20 @@ void DataFile::readLearningSetBlock(std::istream& inputStream) {
                         pfeaturesLen);
 }
 
-void DataFile::writeLearningSetBlock(std::ostream& outputStream) {
-    outputStream << "learning_set: "
-                 << _learningSetLen << " "
-                 << _featuresLen << " "
-                 << _pfeaturesLen << std::endl;
+void DataFile::writeLearningSetBlock(TextWriter& writer) {
+    writer.write("learning_set: ");
+    writer.writeValue(_learningSetLen);
+    writer.write(' ');
+    writer.writeValue(_featuresLen);
+    writer.write(' ');
+    writer.writeValue(_pfeaturesLen);
+    writer.write('\n');
 
-    for (auto i = 0; i < _learningSetLen; ++i) {
-        for (auto j = 0; j < _featuresLen; ++j) {
-            if (_learningSetFeatures[_featuresLen * i + j] != DASH) {
-                outputStream << _learningSetFeatures[_featuresLen * i + j];
-            } else {
-                outputStream << "-";
-            }
-            outputStream << " ";
-        }
-        outputStream << " ";
-        for (auto j = 0; j < _pfeaturesLen; ++j) {
-            if (_learningSetPfeatures[_pfeaturesLen * i + j] != DASH) {
-                outputStream << _learningSetPfeatures[_pfeaturesLen * i + j];
-            } else {
-                outputStream << "-";
-            }
-            outputStream << " ";
-        }
-        outputStream << std::endl;
-    }
+    writeMatrix(writer, true, _learningSetLen,
+                _featuresLen, _learningSetFeatures,
+                _pfeaturesLen, _learningSetPfeatures);
 
-    outputStream << std::endl;
+    writer.write('\n');
 }
 
 
@@ -291,52 +1358,38 @@ void DataFile::setRangesBlock(feature_t* rangesMin,
     if (_featuresLen != DASH && _featuresLen != featuresLen) {
         throw std::runtime_error("Invalid data, featuresLength is not consist in different blocks");
     }
-    if (_rangesMin != nullptr) {
-        delete [] _rangesMin;
-    }
-    if (_rangesMax != nullptr) {
-        delete [] _rangesMax;
-    }
+    releaseArray(_rangesMin);
+    releaseArray(_rangesMax);
+    dropRawBlock(RangesBlock);
 
     _featuresLen = featuresLen;
     _rangesMin = rangesMin;
     _rangesMax = rangesMax;
+    _rangesCalculated = false;
 }
 
-void DataFile::readRangesBlock(std::istream& inputStream) {
-    feature_size_t featuresLen;
-    inputStream >> featuresLen;
+void DataFile::readRangesBlock(TextScanner& scanner) {
+    auto featuresLen = scanner.nextValue<feature_size_t>();
 
     feature_t* rangesMin = new feature_t[featuresLen];
     feature_t* rangesMax = new feature_t[featuresLen];
 
-    for (auto i = 0; i < featuresLen; ++i) {
-        inputStream >> rangesMin[i];
-    }
-    for (auto i = 0; i < featuresLen; ++i) {
-        inputStream >> rangesMax[i];
-    }
+    readMatrix(scanner, 1, featuresLen, rangesMin, featuresLen, rangesMax);
 
     setRangesBlock(rangesMin,
                    rangesMax,
                    featuresLen);
 }
 
-void DataFile::writeRangesBlock(std::ostream& outputStream) {
-    outputStream << "ranges: "
-                 << _featuresLen << std::endl;
-
-    for (auto i = 0; i < _featuresLen; ++i) {
-        outputStream << _rangesMin[i] << " ";
-    }
-    outputStream << std::endl;
+void DataFile::writeRangesBlock(TextWriter& writer) {
+    writer.write("ranges: ");
+    writer.writeValue(_featuresLen);
+    writer.write('\n');
 
-    for (auto i = 0; i < _featuresLen; ++i) {
-        outputStream << _rangesMax[i] << " ";
-    }
-    outputStream << std::endl;
+    writeMatrix(writer, false, 1, _featuresLen, _rangesMin);
+    writeMatrix(writer, false, 1, _featuresLen, _rangesMax);
 
-    outputStream << std::endl;
+    writer.write('\n');
 }
 
 
@@ -350,86 +1403,70 @@ void DataFile::setUimBlock(feature_t* uimSet,
     if (_featuresLen != DASH && _featuresLen != featuresLen) {
         throw std::runtime_error("Invalid data, featuresLength is not consist in different blocks");
     }
-    if (_uimSet != nullptr) {
-        delete [] _uimSet;
-    }
+    releaseArray(_uimSet);
+    dropRawBlock(UimBlock);
 
     _uimSetLen = uimSetLen;
     _featuresLen = featuresLen;
     _uimSet = uimSet;
 }
 
-void DataFile::readUimBlock(std::istream& inputStream) {
-    feature_size_t uimSetLen, featuresLen;
-    inputStream >> uimSetLen >> featuresLen;
+void DataFile::readUimBlock(TextScanner& scanner) {
+    auto uimSetLen = scanner.nextValue<set_size_t>();
+    auto featuresLen = scanner.nextValue<feature_size_t>();
 
-    feature_t* uimSet = new feature_t[uimSetLen * featuresLen];
-
-    for (auto i = 0; i < uimSetLen; ++i) {
-        for (auto j = 0; j < featuresLen; ++j) {
-            inputStream >> uimSet[featuresLen * i + j];
-        }
-    }
+    feature_t* uimSet = new feature_t[static_cast<size_t>(uimSetLen) * featuresLen];
+    readMatrix(scanner, uimSetLen, featuresLen, uimSet);
 
     setUimBlock(uimSet,
                 uimSetLen,
                 featuresLen);
 }
 
-void DataFile::writeUimBlock(std::ostream& outputStream) {
-    outputStream << "uim: "
-                 << _uimSetLen << " "
-                 << _featuresLen << std::endl;
+void DataFile::writeUimBlock(TextWriter& writer) {
+    writer.write("uim: ");
+    writer.writeValue(_uimSetLen);
+    writer.write(' ');
+    writer.writeValue(_featuresLen);
+    writer.write('\n');
 
-    for (auto i = 0; i < _uimSetLen; ++i) {
-        for (auto j = 0; j < _featuresLen; ++j) {
-            outputStream << _uimSet[_featuresLen * i + j] << " ";
-        }
-        outputStream << std::endl;
-    }
+    writeMatrix(writer, false, _uimSetLen, _featuresLen, _uimSet);
 
-    outputStream << std::endl;
+    writer.write('\n');
 }
 
 
-void DataFile::setUimWeightsBlock(feature_t* uimWeights,
+void DataFile::setUimWeightsBlock(weight_t* uimWeights,
                                   feature_size_t featuresLen) {
 
     if (_featuresLen != DASH && _featuresLen != featuresLen) {
         throw std::runtime_error("Invalid data, featuresLength is not consist in different blocks");
     }
-    if (_uimWeights != nullptr) {
-        delete [] _uimWeights;
-    }
+    releaseArray(_uimWeights);
+    dropRawBlock(UimWeightsBlock);
 
     _featuresLen = featuresLen;
     _uimWeights = uimWeights;
 }
 
-void DataFile::readUimWeightsBlock(std::istream& inputStream) {
-    feature_size_t featuresLen;
-    inputStream >> featuresLen;
-
-    feature_t* uimWeights = new feature_t[featuresLen];
+void DataFile::readUimWeightsBlock(TextScanner& scanner) {
+    auto featuresLen = scanner.nextValue<feature_size_t>();
 
-    for (auto i = 0; i < featuresLen; ++i) {
-        inputStream >> uimWeights[i];
-    }
+    weight_t* uimWeights = new weight_t[featuresLen];
+    readMatrix(scanner, 1, featuresLen, uimWeights);
 
     setUimWeightsBlock(uimWeights,
                    featuresLen);
 }
 
-void DataFile::writeUimWeightsBlock(std::ostream& outputStream) {
-    outputStream << "uim_weights: "
-                 << _featuresLen << std::endl;
+void DataFile::writeUimWeightsBlock(TextWriter& writer) {
+    writer.write("uim_weights: ");
+    writer.writeValue(_featuresLen);
+    writer.write('\n');
 
-    for (auto i = 0; i < _featuresLen; ++i) {
-        outputStream << _uimWeights[i] << " ";
-    }
-    outputStream << std::endl;
+    writeMatrix(writer, false, 1, _featuresLen, _uimWeights);
 
-    outputStream << std::endl;
+    writer.write('\n');
 }
 
 
@@ -443,50 +1480,36 @@ void DataFile::setRecognizeSetBlock(feature_t* recognizeSetFeatures,
     if (_featuresLen != DASH && _featuresLen != featuresLen) {
         throw std::runtime_error("Invalid data, featuresLength is not consist in different blocks");
     }
-    if (_recognizeSetFeatures != nullptr) {
-        delete [] _recognizeSetFeatures;
-    }
+    releaseArray(_recognizeSetFeatures);
+    dropRawBlock(RecognizeSetBlock);
 
     _recognizeSetLen = recognizeSetLen;
     _featuresLen = featuresLen;
     _recognizeSetFeatures = recognizeSetFeatures;
 }
 
-void DataFile::readRecognizeSetBlock(std::istream& inputStream) {
-    feature_size_t recognizeSetLen, featuresLen;
-    inputStream >> recognizeSetLen >> featuresLen;
+void DataFile::readRecognizeSetBlock(TextScanner& scanner) {
+    auto recognizeSetLen = scanner.nextValue<set_size_t>();
+    auto featuresLen = scanner.nextValue<feature_size_t>();
 
-    feature_t* recognizeSetFeatures = new feature_t[recognizeSetLen * featuresLen];
-
-    for (auto i = 0; i < recognizeSetLen; ++i) {
-        for (auto j = 0; j < featuresLen; ++j) {
-            recognizeSetFeatures[featuresLen * i + j] = parseNext(inputStream);
-        }
-    }
+    feature_t* recognizeSetFeatures = new feature_t[static_cast<size_t>(recognizeSetLen) * featuresLen];
+    readMatrix(scanner, recognizeSetLen, featuresLen, recognizeSetFeatures);
 
     setRecognizeSetBlock(recognizeSetFeatures,
                          recognizeSetLen,
                          featuresLen);
 }
 
-void DataFile::writeRecognizeSetBlock(std::ostream& outputStream) {
-    outputStream << "recognize_set: "
-                 << _recognizeSetLen << " "
-                 << _featuresLen << std::endl;
+void DataFile::writeRecognizeSetBlock(TextWriter& writer) {
+    writer.write("recognize_set: ");
+    writer.writeValue(_recognizeSetLen);
+    writer.write(' ');
+    writer.writeValue(_featuresLen);
+    writer.write('\n');
 
-    for (auto i = 0; i < _recognizeSetLen; ++i) {
-        for (auto j = 0; j < _featuresLen; ++j) {
-            if (_recognizeSetFeatures[_featuresLen * i + j] != DASH) {
-                outputStream << _recognizeSetFeatures[_featuresLen * i + j];
-            } else {
-                outputStream << "-";
-            }
-            outputStream << " ";
-        }
-        outputStream << std::endl;
-    }
+    writeMatrix(writer, true, _recognizeSetLen, _featuresLen, _recognizeSetFeatures);
 
-    outputStream << std::endl;
+    writer.write('\n');
 }
 
 
@@ -500,6 +1523,7 @@ void DataFile::setTestSetBlock(feature_t* testSetFeatures,
     }
 
     _featuresLen = featuresLen;
+    dropRawBlock(TestSetBlock, hKoef);
 
     auto keyPair = _testSets.find(hKoef);
     if (keyPair == _testSets.end()) {
@@ -510,17 +1534,13 @@ void DataFile::setTestSetBlock(feature_t* testSetFeatures,
     keyPair->second.setSet(testSetFeatures, testSetLen);
 }
 
-void DataFile::readTestSetBlock(std::istream& inputStream) {
-    feature_size_t hKoef, testSetLen, featuresLen;
-    inputStream >> hKoef >> testSetLen >> featuresLen;
+void DataFile::readTestSetBlock(TextScanner& scanner) {
+    auto hKoef = scanner.nextValue<feature_size_t>();
+    auto testSetLen = scanner.nextValue<set_size_t>();
+    auto featuresLen = scanner.nextValue<feature_size_t>();
 
-    feature_t* testSetFeatures = new feature_t[testSetLen * featuresLen];
-
-    for (auto i = 0; i < testSetLen; ++i) {
-        for (auto j = 0; j < featuresLen; ++j) {
-            inputStream >> testSetFeatures[featuresLen * i + j];
-        }
-    }
+    feature_t* testSetFeatures = new feature_t[static_cast<size_t>(testSetLen) * featuresLen];
+    readMatrix(scanner, testSetLen, featuresLen, testSetFeatures);
 
     setTestSetBlock(testSetFeatures,
                     hKoef,
@@ -528,21 +1548,38 @@ void DataFile::readTestSetBlock(std::istream& inputStream) {
                     featuresLen);
 }
 
-void DataFile::writeTestSetBlock(std::ostream& outputStream) {
+void DataFile::writeTestSetBlock(TextWriter& writer) {
+    // Raw and parsed test sets are written in order of their keys
+    std::map<feature_size_t, const RawBlock*> rawTestSets;
+    for (auto& rawBlock : _rawBlocks) {
+        if (rawBlock.block == TestSetBlock) {
+            rawTestSets.emplace(rawBlock.key, &rawBlock);
+        }
+    }
+
+    auto raw = rawTestSets.begin();
     for (auto const & kv : _testSets) {
-        outputStream << "test_set: "
-                     << kv.first << " "
-                     << kv.second.getLen() << " "
-                     << _featuresLen << std::endl;
-
-        for (auto i = 0; i < kv.second.getLen(); ++i) {
-            for (auto j = 0; j < _featuresLen; ++j) {
-                outputStream << kv.second.get(_featuresLen * i + j) << " ";
-            }
-            outputStream << std::endl;
+        for (; raw != rawTestSets.end() && raw->first <= kv.first; ++raw) {
+            writeRawBlock(writer, *raw->second);
+        }
+        if (rawTestSets.find(kv.first) != rawTestSets.end()) {
+            continue;
         }
 
-        outputStream << std::endl;
+        writer.write("test_set: ");
+        writer.writeValue(kv.first);
+        writer.write(' ');
+        writer.writeValue(kv.second.getLen());
+        writer.write(' ');
+        writer.writeValue(_featuresLen);
+        writer.write('\n');
+
+        writeMatrix(writer, false, kv.second.getLen(), _featuresLen, kv.second.getSet());
+
+        writer.write('\n');
+    }
+    for (; raw != rawTestSets.end(); ++raw) {
+        writeRawBlock(writer, *raw->second);
     }
 }
 
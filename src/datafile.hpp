@@ -2,12 +2,21 @@
 #define DATAFILE_H
 
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "global_settings.h"
 
+class ChunkReader;
+class ChunkedText;
+class TextScanner;
+class TextWriter;
+
 class TestSet {
 
 public:
@@ -19,8 +28,9 @@ public:
     TestSet& operator=(const TestSet&) = delete;
 
     void setSet(feature_t* testSet, set_size_t testSetLen);
-    inline feature_t get(set_size_t id) const { return _testSet[id]; }
+    inline feature_t get(size_t id) const { return _testSet[id]; }
     inline set_size_t getLen() const { return _testSetLen; }
+    inline const feature_t* getSet() const { return _testSet; }
 
 private:
     set_size_t _testSetLen;
@@ -28,12 +38,36 @@ private:
 
 };
 
+class LearningSetConsumer {
+
+public:
+    virtual ~LearningSetConsumer() {}
+
+    virtual void begin(set_size_t learningSetLen,
+                       feature_size_t featuresLen,
+                       feature_size_t pfeaturesLen) = 0;
+    virtual void consume(const feature_t* features,
+                         const feature_t* pfeatures) = 0;
+    virtual void end() = 0;
+};
+
 class DataFile {
 
 public:
     const static int NOT_INITIALIZED = std::numeric_limits<set_size_t>::max();
     const static int DASH = std::numeric_limits<feature_t>::max();
 
+    // Blocks of data file, combined into mask of blocks to parse
+    enum Block {
+        LearningSetBlock = 1 << 0,
+        RangesBlock = 1 << 1,
+        UimBlock = 1 << 2,
+        UimWeightsBlock = 1 << 3,
+        RecognizeSetBlock = 1 << 4,
+        TestSetBlock = 1 << 5,
+        AllBlocks = (1 << 6) - 1
+    };
+
 public:
     DataFile();
     virtual ~DataFile();
@@ -41,12 +75,33 @@ public:
     DataFile(const DataFile&) = delete;
     DataFile& operator=(const DataFile&) = delete;
 
+    // Files are mapped into memory and large blocks are parsed in parallel.
+    // Stream and gzip data are read by chunks and parsed as chunks arrive.
+    // Binary data is detected by magic number, its arrays are used right
+    // from memory
     void load(std::istream& inputStream);
+    void load(const std::string& path);
     void save(std::ostream& outputStream);
+
+    // Data is compressed to gzip format if the path ends with .gz
+    void save(const std::string& path);
     void reset();
     void transfer(const DataFile& source);
     void calc();
 
+    // Rows of learning_set block are passed to consumer one by one and
+    // aren't kept in the data file
+    inline void setLearningSetConsumer(LearningSetConsumer* consumer) { _learningSetConsumer = consumer; }
+
+    // Only the given blocks of text data are parsed, others are just found
+    // on load, their arrays stay empty. Blocks which aren't changed since
+    // load are copied to text output as is
+    inline void setParsedBlocks(int blocks) { _parsedBlocks = blocks; }
+
+    // Data is saved in the format it was loaded unless it's set explicitly
+    inline void setBinary(bool binary) { _binary = binary; }
+    inline bool isBinary() const { return _binary; }
+
     void setLearningSetBlock(feature_t* learningSetFeatures,
                              feature_t* learningSetPfeatures,
                              set_size_t learningSetLen,
@@ -61,7 +116,7 @@ public:
                      set_size_t uimSetLen,
                      feature_size_t featuresLen);
 
-    void setUimWeightsBlock(feature_t* uimWeights,
+    void setUimWeightsBlock(weight_t* uimWeights,
                             feature_size_t featuresLen);
 
     void setRecognizeSetBlock(feature_t* recognizeSetFeatures,
@@ -85,23 +140,60 @@ public:
     inline feature_t* getRangesMin() const { return _rangesMin; }
     inline feature_t* getRangesMax() const { return _rangesMax; }
     inline feature_t* getUimSet() const { return _uimSet; }
-    inline feature_t* getUimWeights() const { return _uimWeights; }
+    inline weight_t* getUimWeights() const { return _uimWeights; }
     inline feature_t* getRecognizeSetFeatures() const { return _recognizeSetFeatures; }
 
 private:
-    void readLearningSetBlock(std::istream& inputStream);
-    void readRangesBlock(std::istream& inputStream);
-    void readRecognizeSetBlock(std::istream& inputStream);
-    void readUimBlock(std::istream& inputStream);
-    void readUimWeightsBlock(std::istream& inputStream);
-    void readTestSetBlock(std::istream& inputStream);
-
-    void writeLearningSetBlock(std::ostream& outputStream);
-    void writeRangesBlock(std::ostream& outputStream);
-    void writeRecognizeSetBlock(std::ostream& outputStream);
-    void writeUimBlock(std::ostream& outputStream);
-    void writeUimWeightsBlock(std::ostream& outputStream);
-    void writeTestSetBlock(std::ostream& outputStream);
+    // Text of a block from its header to the next one
+    struct RawBlock {
+        Block block;
+        feature_size_t key;
+        const char* begin;
+        const char* end;
+        std::shared_ptr<const char> text;
+    };
+
+    void loadChunks(ChunkReader& source);
+    void loadText(const char* begin, const char* end, const std::shared_ptr<const char>& text);
+    bool loadTextBlock(TextScanner& scanner, const std::shared_ptr<const char>& text);
+    void loadBinary(const char* begin, const char* end);
+    void saveText(std::ostream& outputStream);
+    void saveBinary(std::ostream& outputStream);
+
+    template<typename T>
+    void releaseArray(T*& array);
+
+    void readBlock(TextScanner& scanner, Block block);
+
+    template<typename T>
+    void readRows(TextScanner& scanner, size_t rowsCount, size_t width,
+                  const std::function<void(const T*)>& consume);
+
+    template<typename T>
+    void readMatrix(TextScanner& scanner, size_t rowsCount,
+                    size_t width1, T* values1, size_t width2 = 0, T* values2 = nullptr);
+    void skipBlock(TextScanner& scanner, Block block);
+    void parseRawBlocks();
+
+    void addRawBlock(Block block, feature_size_t key, const char* begin, const char* end,
+                     const std::shared_ptr<const char>& text);
+    const RawBlock* findRawBlock(Block block, feature_size_t key = 0) const;
+    void dropRawBlock(Block block, feature_size_t key = 0);
+    void writeRawBlock(TextWriter& writer, const RawBlock& rawBlock);
+
+    void readLearningSetBlock(TextScanner& scanner);
+    void readRangesBlock(TextScanner& scanner);
+    void readRecognizeSetBlock(TextScanner& scanner);
+    void readUimBlock(TextScanner& scanner);
+    void readUimWeightsBlock(TextScanner& scanner);
+    void readTestSetBlock(TextScanner& scanner);
+
+    void writeLearningSetBlock(TextWriter& writer);
+    void writeRangesBlock(TextWriter& writer);
+    void writeRecognizeSetBlock(TextWriter& writer);
+    void writeUimBlock(TextWriter& writer);
+    void writeUimWeightsBlock(TextWriter& writer);
+    void writeTestSetBlock(TextWriter& writer);
 
 private:
     set_size_t _learningSetLen;
@@ -116,9 +208,25 @@ private:
     feature_t* _rangesMin;
     feature_t* _rangesMax;
     feature_t* _uimSet;
-    feature_t* _uimWeights;
+    weight_t* _uimWeights;
     feature_t* _recognizeSetFeatures;
     std::map<feature_size_t, TestSet> _testSets;
+
+    bool _binary;
+    std::shared_ptr<const char> _mapping;
+    size_t _mappingSize;
+
+    // Device and inode of mapped input files, arrays and raw blocks
+    // may refer to them until reset
+    std::vector<std::pair<uint64_t, uint64_t>> _mappedFiles;
+
+    int _parsedBlocks;
+    std::vector<RawBlock> _rawBlocks;
+
+    LearningSetConsumer* _learningSetConsumer;
+
+    // Text of stream input while it's loaded
+    ChunkedText* _chunkedText;
 };
 
 #endif // DATAFILE_H
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <cstring>
+#include <string>
+
+#include "../argparse-port/argparse.h"
+
+#include "global_settings.h"
+#include "datafile.hpp"
+
+INIT_DEBUG_OUTPUT();
+
+int main(int argc, char** argv)
+{
+    parser_t* parser;
+    parser_init(&parser);
+
+    parser_string_arg_t* input_arg;
+    parser_string_add_arg(parser, &input_arg, "input");
+    parser_string_set_help(input_arg, "input file in text or binary format");
+
+    parser_string_arg_t* output_arg;
+    parser_string_add_arg(parser, &output_arg, "output");
+    parser_string_set_help(output_arg, "output file");
+
+    parser_flag_arg_t* text_arg;
+    parser_flag_add_arg(parser, &text_arg, "--text");
+    parser_flag_set_help(text_arg, "save in text format, by default format of input is switched");
+
+    parser_flag_arg_t* binary_arg;
+    parser_flag_add_arg(parser, &binary_arg, "--binary");
+    parser_flag_set_help(binary_arg, "save in binary format, by default format of input is switched");
+
+    if (parser_parse(parser, argc, argv) != PARSER_RESULT_OK) {
+        printf("%s", parser_get_last_err(parser));
+        parser_free(&parser);
+        return 1;
+    }
+
+    if (parser_flag_is_filled(text_arg) && parser_flag_is_filled(binary_arg)) {
+        printf("Only one of --text and --binary is allowed\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    DataFile dataFile;
+    if (strcmp("-", parser_string_get_value(input_arg)) != 0) {
+        dataFile.load(std::string(parser_string_get_value(input_arg)));
+    } else {
+        dataFile.load(std::cin);
+    }
+
+    if (parser_flag_is_filled(text_arg)) {
+        dataFile.setBinary(false);
+    } else if (parser_flag_is_filled(binary_arg)) {
+        dataFile.setBinary(true);
+    } else {
+        dataFile.setBinary(!dataFile.isBinary());
+    }
+
+    if (strcmp("-", output_arg->value) != 0) {
+        dataFile.save(std::string(output_arg->value));
+    } else {
+        dataFile.save(std::cout);
+    }
+
+    parser_free(&parser);
+    return 0;
+}
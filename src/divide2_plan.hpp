@@ -27,7 +27,7 @@ class Divide2Task
         return _second[id];
     }
 
-    void append(int item, int weight) {
+    void append(int item, long long weight) {
         if (_secondWeight > _firstWeight) {
             _first.push_back(item);
             _firstWeight += weight;
@@ -45,8 +45,8 @@ class Divide2Task
     
     std::vector<int> _first;
     std::vector<int> _second;
-    int _firstWeight;
-    int _secondWeight;
+    long long _firstWeight;
+    long long _secondWeight;
     
 };
 
@@ -0,0 +1,75 @@
+#ifndef FEATURE_WORDS_H
+#define FEATURE_WORDS_H
+
+#include <algorithm>
+
+#include "global_settings.h"
+
+typedef uint64_t feature_word_t;
+const int feature_word_bits = std::numeric_limits<feature_word_t>::digits;
+
+inline feature_size_t getFeatureWordsLen(feature_size_t featuresLen) {
+    return (featuresLen + feature_word_bits - 1) / feature_word_bits;
+}
+
+// Kernels over sets of features packed to words. WordsLen is the amount of
+// words known at compile time, so loops over 1, 2 or 4 words are unrolled
+// and kept in registers; WordsLen of 0 is the generic version which takes
+// the amount at runtime. Callers choose the specialization once per call of
+// the outer loop by the amount of words of their input, see
+// FEATURE_WORDS_DISPATCH
+template<feature_size_t WordsLen>
+class FeatureWords final {
+
+public:
+    static inline feature_size_t getLen(feature_size_t wordsLen) {
+        return WordsLen != 0 ? WordsLen : wordsLen;
+    }
+
+    static inline void pack(const test_feature_t* row, feature_size_t featuresLen,
+                            feature_word_t* outWords, feature_size_t wordsLen) {
+        std::fill(&outWords[0], &outWords[getLen(wordsLen)], 0);
+        for (feature_size_t j = 0; j < featuresLen; ++j) {
+            if (row[j]) {
+                outWords[j / feature_word_bits] |= static_cast<feature_word_t>(1) << (j % feature_word_bits);
+            }
+        }
+    }
+
+    static inline feature_size_t count(const feature_word_t* words, feature_size_t wordsLen) {
+        feature_size_t result = 0;
+        for (feature_size_t w = 0; w < getLen(wordsLen); ++w) {
+            result += __builtin_popcountll(words[w]);
+        }
+        return result;
+    }
+
+    // Checks whether every feature of first is in second too
+    static inline bool isSubset(const feature_word_t* first, const feature_word_t* second, feature_size_t wordsLen) {
+        feature_word_t rest = 0;
+        for (feature_size_t w = 0; w < getLen(wordsLen); ++w) {
+            rest |= first[w] & ~second[w];
+        }
+        return rest == 0;
+    }
+
+    // Adds features of values which are absent in mask to outWords
+    static inline void orAndNot(const feature_word_t* values, const feature_word_t* mask,
+                                feature_word_t* outWords, feature_size_t wordsLen) {
+        for (feature_size_t w = 0; w < getLen(wordsLen); ++w) {
+            outWords[w] |= values[w] & ~mask[w];
+        }
+    }
+};
+
+// Expands to a switch which evaluates call with WORDS defined as the
+// specialization for wordsLen
+#define FEATURE_WORDS_DISPATCH(wordsLen, call)\
+    switch (wordsLen) {\
+    case 1: { const feature_size_t WORDS = 1; call; } break;\
+    case 2: { const feature_size_t WORDS = 2; call; } break;\
+    case 4: { const feature_size_t WORDS = 4; call; } break;\
+    default: { const feature_size_t WORDS = 0; call; } break;\
+    }
+
+#endif // FEATURE_WORDS_H
@@ -13,6 +13,7 @@ typedef  uint8_t test_feature_t;
 typedef uint32_t feature_size_t;
 typedef uint32_t set_size_t;
 typedef uint64_t calc_hash_t;
+typedef uint64_t weight_t;
 const int calc_hash_bits = std::numeric_limits<calc_hash_t>::digits;
 
 #if MULTITHREAD
@@ -5,8 +5,14 @@
 #include <map>
 #include <tuple>
 #include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+#include <functional>
+#include <numeric>
 
 #ifdef MULTITHREAD
+#include <atomic>
 #include <thread>
 #include <condition_variable>
 #ifndef DIFFERENT_MATRICES
@@ -18,53 +24,63 @@
 #include "workrow.hpp"
 #include "timecollector.hpp"
 #include "irredundant_matrix.hpp"
+#include "checkpoint.hpp"
+#include "shard_plan.hpp"
+#include "pair_tiles.hpp"
 
 #if defined(MULTITHREAD_DIVIDE2) || defined(MULTITHREAD_DIVIDE2_OPTIMIZED)
 #include "divide2_plan.hpp"
-#elif MULTITHREAD_MANYWORKERS
+#elif defined(MULTITHREAD_MASTERWORKER)
 #include "manyworkers_plan.hpp"
 #endif
 
+// Class pairs are split into tiles of at most this amount of row pairs,
+// it bounds work of a single task for balancing and checkpoints
+const long long TILE_PAIRS = 1LL << 22;
+
 InputMatrix::InputMatrix(const DataFile& datafile) {
     _rowsCount = datafile.getLearningSetLen();
     _qColsCount = datafile.getFeaturesLen();
     _rColsCount = datafile.getPfeaturesLen();
 
-    _qMatrix = new int[_rowsCount * _qColsCount];
+    // Learning set isn't copied, rows are grouped by classes through _order,
+    // so datafile has to outlive the calculation
+    _qMatrix = reinterpret_cast<const int*>(datafile.getLearningSetFeatures());
+    _rMatrix = reinterpret_cast<const int*>(datafile.getLearningSetPfeatures());
     _qMinimum = new int[_qColsCount];
     _qMaximum = new int[_qColsCount];
-    _rMatrix = new int[_rowsCount * _rColsCount];
 
-    for(auto i=0; i<_rowsCount; ++i) {
-        for(auto j=0; j<_qColsCount; ++j) {
-            setFeature(i, j, datafile.getLearningSetFeatures()[i * _qColsCount + j]);
-        }
-        for(auto j=0; j<_rColsCount; ++j) {
-            setImage(i, j, datafile.getLearningSetPfeatures()[i * _rColsCount + j]);
-        }
-    }
+    _order.resize(_rowsCount);
+    std::iota(_order.begin(), _order.end(), 0);
+
     for(auto j=0; j<_qColsCount; ++j) {
         _qMinimum[j] = datafile.getRangesMin()[j];
         _qMaximum[j] = datafile.getRangesMax()[j];
     }
 
     _r2Matrix = new int[_rowsCount];
+    _checkpoint = nullptr;
 
     START_COLLECT_TIME(preparingInput, Counters::PreparingInput);
+    reduceFeatures();
     calcR2Matrix();
     sortMatrix();
     calcR2Indexes();
+    _pairTiles = new PairTiles(_r2Counts.data(), _r2Counts.size(), TILE_PAIRS);
     STOP_COLLECT_TIME(preparingInput);
 }
 
 InputMatrix::~InputMatrix() {
-    delete[] _rMatrix;
+    delete _pairTiles;
     delete[] _r2Matrix;
-    delete[] _qMatrix;
     delete[] _qMaximum;
     delete[] _qMinimum;
 }
 
+void InputMatrix::setCheckpoint(Checkpoint* checkpoint) {
+    _checkpoint = checkpoint;
+}
+
 void InputMatrix::printFeatureMatrix(std::ostream& stream) {
     START_COLLECT_TIME(writingOutput, Counters::WritingOutput);
 
@@ -125,12 +141,118 @@ void InputMatrix::printDebugInfo(std::ostream& stream) {
     STOP_COLLECT_TIME(writingOutput);
 }
 
+void InputMatrix::reduceFeatures()
+{
+    // Constant features without dashes give zero column in every difference
+    // row, features equal to another one with the same range give a copy of
+    // its column, so both are excluded from calculation
+    std::vector<int> representatives(_qColsCount, -1);
+    std::map<std::tuple<size_t, int, int>, std::vector<int>> candidates;
+
+    auto isConstant = [this](int col) {
+        for(auto i=0; i<_rowsCount; ++i) {
+            if(getFeature(i, col) == DataFile::DASH || getFeature(i, col) != getFeature(0, col)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    auto isEqual = [this](int col1, int col2) {
+        for(auto i=0; i<_rowsCount; ++i) {
+            if(getFeature(i, col1) != getFeature(i, col2)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<int> kept;
+    for(auto j=0; j<_qColsCount; ++j) {
+        if(_rowsCount > 0 && isConstant(j)) {
+            continue;
+        }
+
+        size_t hash = 0;
+        for(auto i=0; i<_rowsCount; ++i) {
+            hash = hash * 31 + static_cast<unsigned int>(getFeature(i, j));
+        }
+
+        auto& sameHash = candidates[std::make_tuple(hash, _qMinimum[j], _qMaximum[j])];
+        auto duplicate = std::find_if(sameHash.begin(), sameHash.end(),
+                                      [&isEqual, j](int col) { return isEqual(col, j); });
+        if(duplicate != sameHash.end()) {
+            representatives[j] = *duplicate;
+        } else {
+            sameHash.push_back(j);
+            representatives[j] = j;
+            kept.push_back(j);
+        }
+    }
+
+    // Irredundant matrix can't be empty, at least one feature is kept
+    if(kept.empty() && _qColsCount > 0) {
+        kept.push_back(0);
+        representatives[0] = 0;
+    }
+
+    _featureMapping.assign(_qColsCount, -1);
+    for(size_t k=0; k<kept.size(); ++k) {
+        _featureMapping[kept[k]] = k;
+    }
+    for(auto j=0; j<_qColsCount; ++j) {
+        if(representatives[j] >= 0) {
+            _featureMapping[j] = _featureMapping[representatives[j]];
+        }
+    }
+
+    DEBUG_INFO("InputMatrix: " << kept.size() << " of " << _qColsCount << " features are kept");
+
+    if(kept.size() == static_cast<size_t>(_qColsCount)) {
+        return;
+    }
+
+    int reducedColsCount = kept.size();
+    std::vector<int> qMatrix(static_cast<size_t>(_rowsCount) * reducedColsCount);
+    auto qMinimum = new int[reducedColsCount];
+    auto qMaximum = new int[reducedColsCount];
+    _dashFactors.assign(reducedColsCount, 1);
+
+    for(auto i=0; i<_rowsCount; ++i) {
+        for(auto k=0; k<reducedColsCount; ++k) {
+            qMatrix[static_cast<size_t>(i)*reducedColsCount + k] = getFeature(i, kept[k]);
+        }
+    }
+    for(auto k=0; k<reducedColsCount; ++k) {
+        qMinimum[k] = _qMinimum[kept[k]];
+        qMaximum[k] = _qMaximum[kept[k]];
+    }
+
+    // Dash in feature is a dash in all of its aliases, so it multiplies
+    // weights of other features once per alias
+    for(auto j=0; j<_qColsCount; ++j) {
+        if(representatives[j] >= 0) {
+            _dashFactors[_featureMapping[j]] *= _qMaximum[j] - _qMinimum[j] + 1;
+        }
+    }
+
+    delete[] _qMinimum;
+    delete[] _qMaximum;
+
+    // Rows of the reduced copy keep order of the learning set
+    _reducedMatrix.swap(qMatrix);
+    _qMatrix = _reducedMatrix.data();
+    _qMinimum = qMinimum;
+    _qMaximum = qMaximum;
+    _qColsCount = reducedColsCount;
+}
+
 void InputMatrix::calcR2Matrix()
 {
     auto currentId = 0;
     std::map<WorkRow, int> mappings;
     for(auto i=0; i<_rowsCount; ++i) {
-        WorkRow currentRow(_rMatrix, i, _rColsCount);
+        WorkRow currentRow(_rMatrix, _order[i], _rColsCount);
         auto mapping = mappings.find(currentRow);
 
         if(mapping != mappings.end()) {
@@ -171,26 +293,17 @@ void InputMatrix::sortMatrix() {
         indexes[_r2Matrix[i]] += 1;
     }
 
-    auto oldQMatrix = _qMatrix;
-    auto oldRMatrix = _rMatrix;
+    // Only indexes of rows are permuted, matrices stay in place
+    std::vector<int> oldOrder(_rowsCount);
+    oldOrder.swap(_order);
     auto oldR2Matrix = _r2Matrix;
-
-    _qMatrix = new int[_rowsCount * _qColsCount];
-    _rMatrix = new int[_rowsCount * _rColsCount];
     _r2Matrix = new int[_rowsCount];
 
     for(auto i=0; i<_rowsCount; ++i) {
-        for(auto j=0; j<_qColsCount; ++j) {
-            _qMatrix[newIndexes[i]*_qColsCount + j] = oldQMatrix[i*_qColsCount + j];
-        }
-        for(auto j=0; j<_rColsCount; ++j) {
-            _rMatrix[newIndexes[i]*_rColsCount + j] = oldRMatrix[i*_rColsCount + j];
-        }
+        _order[newIndexes[i]] = oldOrder[i];
         _r2Matrix[newIndexes[i]] = oldR2Matrix[i];
     }
 
-    delete[] oldQMatrix;
-    delete[] oldRMatrix;
     delete[] oldR2Matrix;
 }
 
@@ -214,6 +327,18 @@ void InputMatrix::calcR2Indexes() {
     _r2Counts.push_back(_rowsCount - startIndex);
 }
 
+int InputMatrix::getTasksCount() const
+{
+    return _pairTiles->getTilesCount();
+}
+
+void InputMatrix::processTile(IrredundantMatrix &irredundantMatrix, const PairTile& tile)
+{
+    processBlock(irredundantMatrix,
+                 _r2Indexes[tile.getFirst()] + tile.getOffset(), tile.getLength(),
+                 _r2Indexes[tile.getSecond()], _r2Counts[tile.getSecond()]);
+}
+
 #if defined(MULTITHREAD_DIVIDE2) || defined(MULTITHREAD_DIVIDE2_OPTIMIZED)
 
 void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
@@ -259,17 +384,34 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
                         DEBUG_INFO("Thread " << threadId << " is working on " <<
                                    task->getFirstSize() << ":" << task->getSecondSize());
 
+                        if (_checkpoint != nullptr) {
+                            _checkpoint->beginTask();
+                        }
+
+                        std::vector<int> taskIds;
                         for(auto i=0; i<task->getFirstSize(); ++i) {
                             for(auto j=0; j<task->getSecondSize(); ++j) {
-                                processBlock(*currentMatrix,
-                                             _r2Indexes[task->getFirst(i)], _r2Counts[task->getFirst(i)],
-                                             _r2Indexes[task->getSecond(j)], _r2Counts[task->getSecond(j)]);
+                                auto first = task->getFirst(i);
+                                auto second = task->getSecond(j);
+                                for(auto taskId = _pairTiles->getPairBegin(first, second);
+                                    taskId < _pairTiles->getPairEnd(first, second); ++taskId) {
+                                    if (_checkpoint != nullptr && _checkpoint->isCompleted(taskId)) {
+                                        continue;
+                                    }
+
+                                    processTile(*currentMatrix, _pairTiles->getTile(taskId));
+                                    taskIds.push_back(taskId);
+                                }
                             }
                         }
 
                         #ifdef DIFFERENT_MATRICES
                         irredundantMatrix.addMatrixConcurrent(std::move(matrixForThread));
                         #endif
+
+                        if (_checkpoint != nullptr) {
+                            _checkpoint->endTask(taskIds);
+                        }
                     }
                 }
 
@@ -314,7 +456,7 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
     }
 }
 
-#elif MULTITHREAD_MANYWORKERS
+#elif defined(MULTITHREAD_MASTERWORKER)
 
 void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
 {
@@ -324,7 +466,7 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
 
     std::vector<std::thread> threads(maxThreads);
 
-    ManyWorkersPlan planBuilder(_r2Counts.data(), _r2Counts.size());
+    ManyWorkersPlan planBuilder(*_pairTiles);
 
     for(auto threadId = 0; threadId < maxThreads; ++threadId) {
         START_COLLECT_TIME(threading, Counters::Threading);
@@ -348,6 +490,14 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
                     break;
                 }
 
+                auto taskId = task->getId();
+                if (_checkpoint != nullptr) {
+                    if (_checkpoint->isCompleted(taskId)) {
+                        continue;
+                    }
+                    _checkpoint->beginTask();
+                }
+
                 DEBUG_INFO("Thread " << threadId << " is working on " << task->getFirst() << ":" << task->getSecond());
 
                 #ifdef DIFFERENT_MATRICES
@@ -355,12 +505,16 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix)
                 #endif
 
                 processBlock(*currentMatrix,
-                             _r2Indexes[task->getFirst()], _r2Counts[task->getFirst()],
+                             _r2Indexes[task->getFirst()] + task->getOffset(), task->getLength(),
                              _r2Indexes[task->getSecond()], _r2Counts[task->getSecond()]);
 
                 #ifdef DIFFERENT_MATRICES
                 irredundantMatrix.addMatrixConcurrent(std::move(matrixForThread));
                 #endif
+
+                if (_checkpoint != nullptr) {
+                    _checkpoint->endTask(taskId);
+                }
             }
 
             TimeCollector::ThreadFinalize();
@@ -383,35 +537,178 @@ void InputMatrix::calculate(IrredundantMatrix &irredundantMatrix) {
     auto currentMatrix = &irredundantMatrix;
     #endif
 
-    for(size_t i=0; i<_r2Indexes.size()-1; ++i) {
-        for(size_t j=i+1; j<_r2Indexes.size(); ++j) {
+    for(auto taskId=0; taskId<_pairTiles->getTilesCount(); ++taskId) {
+        if (_checkpoint != nullptr) {
+            if (_checkpoint->isCompleted(taskId)) {
+                continue;
+            }
+            _checkpoint->beginTask();
+        }
+
+        #ifdef DIFFERENT_MATRICES
+        matrixForThread.clear();
+        #endif
+
+        processTile(*currentMatrix, _pairTiles->getTile(taskId));
+
+        #ifdef DIFFERENT_MATRICES
+        irredundantMatrix.addMatrixConcurrent(std::move(matrixForThread));
+        #endif
+
+        if (_checkpoint != nullptr) {
+            _checkpoint->endTask(taskId);
+        }
+    }
+}
+
+#endif
+
+void InputMatrix::calculateShard(IrredundantMatrix &irredundantMatrix, int shard, int shardsCount) {
+    ShardPlan planBuilder(_r2Counts.data(), _r2Counts.size(), shardsCount);
+    auto& tiles = planBuilder.getTiles(shard);
+
+    DEBUG_INFO("Shard " << shard << ": " << tiles.size() << " tiles, weight " << planBuilder.getShardWeight(shard));
+
+    auto processTiles = [this, &irredundantMatrix, &tiles](std::function<int()> nextTile)
+    {
+        #ifdef DIFFERENT_MATRICES
+        IrredundantMatrix matrixForThread(_qColsCount);
+        auto currentMatrix = &matrixForThread;
+        #else
+        auto currentMatrix = &irredundantMatrix;
+        #endif
+
+        for(auto tileId = nextTile(); tileId < static_cast<int>(tiles.size()); tileId = nextTile()) {
+            auto& tile = tiles[tileId];
+
             #ifdef DIFFERENT_MATRICES
             matrixForThread.clear();
             #endif
 
-            processBlock(*currentMatrix, _r2Indexes[i], _r2Counts[i], _r2Indexes[j], _r2Counts[j]);
+            processTile(*currentMatrix, tile);
 
             #ifdef DIFFERENT_MATRICES
             irredundantMatrix.addMatrixConcurrent(std::move(matrixForThread));
             #endif
         }
+    };
+
+#ifdef MULTITHREAD
+    std::atomic<int> currentTile(0);
+    std::vector<std::thread> threads(std::thread::hardware_concurrency());
+
+    for(auto& thread : threads) {
+        START_COLLECT_TIME(threading, Counters::Threading);
+        thread = std::thread([&processTiles, &currentTile]()
+        {
+            TimeCollector::ThreadInitialize();
+            processTiles([&currentTile]() { return currentTile.fetch_add(1); });
+            TimeCollector::ThreadFinalize();
+        });
+        STOP_COLLECT_TIME(threading);
     }
-}
 
+    for(auto& thread : threads) {
+        thread.join();
+    }
+#else
+    auto currentTile = 0;
+    processTiles([&currentTile]() { return currentTile++; });
 #endif
+}
+
+void InputMatrix::calculateSampled(IrredundantMatrix &irredundantMatrix, double rate, unsigned int seed, bool verify) {
+    std::mt19937_64 generator(seed);
+    std::vector<double> sampledR(_qColsCount);
+    weight_t r[_qColsCount];
+
+    for(size_t i=0; i<_r2Indexes.size()-1; ++i) {
+        for(size_t j=i+1; j<_r2Indexes.size(); ++j) {
+            // Every class pair is sampled separately with the same rate
+            long long total = static_cast<long long>(_r2Counts[i]) * _r2Counts[j];
+            long long amount = std::min(total, std::max(1LL, std::llround(rate * total)));
+
+            // Floyd's algorithm, choose amount of different pairs from total
+            std::unordered_set<long long> chosen;
+            for(auto k = total - amount; k < total; ++k) {
+                auto pair = std::uniform_int_distribution<long long>(0, k)(generator);
+                chosen.insert(chosen.count(pair) ? k : pair);
+            }
+
+            std::vector<long long> pairs(chosen.begin(), chosen.end());
+            std::sort(pairs.begin(), pairs.end());
+
+            DEBUG_INFO("Sampling " << i << ":" << j << ", " << amount << " of " << total);
+
+            std::fill(sampledR.begin(), sampledR.end(), 0.0);
+            for(auto pair : pairs) {
+                START_COLLECT_TIME(qHandling, Counters::QHandling);
+
+                auto index1 = _r2Indexes[i] + pair / _r2Counts[j];
+                auto index2 = _r2Indexes[j] + pair % _r2Counts[j];
+                WorkRow row1(_qMatrix, _order[index1], _qColsCount);
+                WorkRow row2(_qMatrix, _order[index2], _qColsCount);
+
+                auto diffRow = Row::createAsDifference(row1, row2);
+
+                calcRVector(r, row1, row2, _qMinimum, _qMaximum, getDashFactors());
+                STOP_COLLECT_TIME(qHandling);
+
+                if (verify) {
+                    _sampledPairs.push_back(static_cast<long long>(index1) * _rowsCount + index2);
+                    irredundantMatrix.addRow(std::move(diffRow), r);
+                    continue;
+                }
+
+                for(auto k=0; k<_qColsCount; ++k) {
+                    sampledR[k] += r[k];
+                }
+                irredundantMatrix.addRow(std::move(diffRow), nullptr);
+            }
+
+            if (verify) {
+                continue;
+            }
+
+            // Weights are estimated by scaling of sampled sum to all pairs of class pair
+            for(auto k=0; k<_qColsCount; ++k) {
+                r[k] = static_cast<weight_t>(std::llround(sampledR[k] * total / amount));
+            }
+            irredundantMatrix.addWeights(r);
+        }
+    }
+
+    if (verify) {
+        // Only pairs which weren't sampled are handled by the configured
+        // engine, they add missed rows and the rest of exact weights
+        std::sort(_sampledPairs.begin(), _sampledPairs.end());
+        calculate(irredundantMatrix);
+        std::vector<long long>().swap(_sampledPairs);
+    }
+}
 
 void InputMatrix::processBlock(IrredundantMatrix &irredundantMatrix,
                                int offset1, int length1, int offset2, int length2) {
     for(auto i=0; i<length1; ++i) {
+        // Sampled pairs of the row are sorted, so they are passed in order
+        auto key = static_cast<long long>(offset1 + i) * _rowsCount + offset2;
+        auto sampled = std::lower_bound(_sampledPairs.begin(), _sampledPairs.end(), key);
+
         for(auto j=0; j<length2; ++j) {
+            if (sampled != _sampledPairs.end() && *sampled == key + j) {
+                ++sampled;
+                continue;
+            }
+
             START_COLLECT_TIME(qHandling, Counters::QHandling);
 
-            auto diffRow = Row::createAsDifference(
-                                                   WorkRow(_qMatrix, offset1+i, _qColsCount),
-                                                   WorkRow(_qMatrix, offset2+j, _qColsCount));
+            WorkRow row1(_qMatrix, _order[offset1+i], _qColsCount);
+            WorkRow row2(_qMatrix, _order[offset2+j], _qColsCount);
+
+            auto diffRow = Row::createAsDifference(row1, row2);
 
-            int r[_qColsCount];
-            calcRVector(r, offset1+i, offset2+j);
+            weight_t r[_qColsCount];
+            calcRVector(r, row1, row2, _qMinimum, _qMaximum, getDashFactors());
             STOP_COLLECT_TIME(qHandling);
 
             #ifdef ADD_ROW_CONCURRENT
@@ -423,32 +720,43 @@ void InputMatrix::processBlock(IrredundantMatrix &irredundantMatrix,
     }
 }
 
-void InputMatrix::calcRVector(int* r, int row1, int row2) {
-    auto multiplier1 = 1;
-    auto multiplier2 = 1;
+void InputMatrix::calcRVector(weight_t* r, const WorkRow& row1, const WorkRow& row2,
+                              const int* qMinimum, const int* qMaximum,
+                              const weight_t* dashFactors) {
+    weight_t multiplier1 = 1;
+    weight_t multiplier2 = 1;
+    auto width = row1.getWidth();
+
+    auto getFeatureValuesCount = [qMinimum, qMaximum](int col) {
+        return static_cast<weight_t>(qMaximum[col] - qMinimum[col] + 1);
+    };
+
+    auto getDashFactor = [dashFactors, &getFeatureValuesCount](int col) {
+        return dashFactors != nullptr ? dashFactors[col] : getFeatureValuesCount(col);
+    };
 
-    for(auto k=0; k<_qColsCount; ++k) {
+    for(auto k=0; k<width; ++k) {
         r[k] = 0;
-        if(getFeature(row1, k) == DataFile::DASH) {
-            multiplier1 *= getFeatureValuesCount(k);
+        if(row1.getValue(k) == DataFile::DASH) {
+            multiplier1 *= getDashFactor(k);
         }
-        if(getFeature(row2, k) == DataFile::DASH) {
-            multiplier2 *= getFeatureValuesCount(k);
+        if(row2.getValue(k) == DataFile::DASH) {
+            multiplier2 *= getDashFactor(k);
         }
     }
 
-    auto calcLimits = [this](int row, int col) {
-        return getFeature(row, col) == DataFile::DASH
-           ? std::tuple<int, int>(_qMinimum[col], _qMaximum[col])
-           : std::tuple<int, int>(getFeature(row, col), getFeature(row, col));
+    auto calcLimits = [qMinimum, qMaximum](const WorkRow& row, int col) {
+        return row.getValue(col) == DataFile::DASH
+           ? std::tuple<int, int>(qMinimum[col], qMaximum[col])
+           : std::tuple<int, int>(row.getValue(col), row.getValue(col));
     };
 
-    for (auto k=0; k<_qColsCount; ++k) {
+    for (auto k=0; k<width; ++k) {
         auto multiplier = multiplier1 * multiplier2;
-        if(getFeature(row1, k) == DataFile::DASH) {
+        if(row1.getValue(k) == DataFile::DASH) {
             multiplier /= getFeatureValuesCount(k);
         }
-        if(getFeature(row2, k) == DataFile::DASH) {
+        if(row2.getValue(k) == DataFile::DASH) {
             multiplier /= getFeatureValuesCount(k);
         }
 
@@ -456,7 +764,7 @@ void InputMatrix::calcRVector(int* r, int row1, int row2) {
         for (auto i = std::get<0>(limit1); i <= std::get<1>(limit1); ++i) {
             auto limit2 = calcLimits(row2, k);
             for (auto j = std::get<0>(limit2); j <= std::get<1>(limit2); ++j) {
-                r[k] += std::abs(i - j) * multiplier;
+                r[k] += static_cast<weight_t>(std::abs(i - j)) * multiplier;
             }
         }
     }
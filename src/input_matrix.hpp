@@ -6,6 +6,11 @@
 
 #include "datafile.hpp"
 #include "irredundant_matrix.hpp"
+#include "workrow.hpp"
+
+class Checkpoint;
+class PairTile;
+class PairTiles;
 
 class InputMatrix
 {
@@ -22,16 +27,23 @@ public:
                       int offset1, int length1, int offset2, int length2);
 
     void calculate(IrredundantMatrix& irredundantMatrix);
+    void setCheckpoint(Checkpoint* checkpoint);
+    int getTasksCount() const;
+    void calculateShard(IrredundantMatrix& irredundantMatrix, int shard, int shardsCount);
+    // Weights are estimated from sampled pairs, when verify is set the
+    // rest of pairs is calculated over sampled matrix to get exact result
+    void calculateSampled(IrredundantMatrix& irredundantMatrix, double rate, unsigned int seed, bool verify);
+
+    // dashFactors are multipliers of weights of other features when a value
+    // is dash, by default it's amount of values of the feature
+    static void calcRVector(weight_t* r, const WorkRow& row1, const WorkRow& row2,
+                            const int* qMinimum, const int* qMaximum,
+                            const weight_t* dashFactors = nullptr);
 
 public:
-    inline void setFeature(int i, int j, int value)
-    {
-        _qMatrix[i*_qColsCount + j] = value;
-    }
-
     inline int getFeature(int i, int j) const
     {
-        return _qMatrix[i*_qColsCount + j];
+        return _qMatrix[static_cast<size_t>(_order[i])*_qColsCount + j];
     }
 
     inline int getFeatureValuesCount(int j) const
@@ -44,22 +56,30 @@ public:
         return _qColsCount;
     }
 
-    inline void setImage(int i, int j, int value)
+    // Index of the feature among calculated ones for every feature of
+    // input data, -1 for skipped constant features
+    inline const std::vector<int>& getFeatureMapping() const
     {
-        _rMatrix[i*_rColsCount + j] = value;
+        return _featureMapping;
+    }
+
+    inline const weight_t* getDashFactors() const
+    {
+        return _dashFactors.empty() ? nullptr : _dashFactors.data();
     }
 
     inline int getImage(int i, int j) const
     {
-        return _rMatrix[i*_rColsCount + j];
+        return _rMatrix[static_cast<size_t>(_order[i])*_rColsCount + j];
     }
 
 private:
 
+    void reduceFeatures();
     void calcR2Matrix();
     void sortMatrix();
     void calcR2Indexes();
-    void calcRVector(int* r, int row1, int row2);
+    void processTile(IrredundantMatrix& irredundantMatrix, const PairTile& tile);
 
     void calcUseSingleThreadAlgo(IrredundantMatrix& irredundantMatrix);
     void calcUseMultithreadDivide2Algo(IrredundantMatrix& irredundantMatrix);
@@ -71,16 +91,31 @@ private:
     int _qColsCount;
     int _rColsCount;
 
-    int* _qMatrix;
+    // Views of learning set of DataFile or of _reducedMatrix, row i of
+    // InputMatrix is row _order[i] of the views
+    const int* _qMatrix;
     int* _qMinimum;
     int* _qMaximum;
-    int* _rMatrix;
+    const int* _rMatrix;
+
+    std::vector<int> _order;
+    std::vector<int> _reducedMatrix;
 
     int* _r2Matrix;
     int _r2Count;
 
     std::vector<int> _r2Indexes;
     std::vector<int> _r2Counts;
+
+    std::vector<int> _featureMapping;
+    std::vector<weight_t> _dashFactors;
+
+    PairTiles* _pairTiles;
+    Checkpoint* _checkpoint;
+
+    // Sorted pairs of rows which are skipped by processBlock as already
+    // handled by sampled calculation, pair of rows i and j is i*_rowsCount+j
+    std::vector<long long> _sampledPairs;
 };
 
 #endif // INPUTMATRIX_H>
@@ -1,32 +1,161 @@
 #include "irredundant_matrix.hpp"
 
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
 #include <thread>
 
+#include <unistd.h>
+
 #include "global_settings.h"
 #include "timecollector.hpp"
 
+// Rows are stored in sparse form when the first rows have at most
+// 1/SPARSE_DENSITY_DIVISOR nonzero values on average
+const int SPARSE_SAMPLE_ROWS = 1024;
+const int SPARSE_MIN_WIDTH = 32;
+const int SPARSE_DENSITY_DIVISOR = 8;
+
+// Smallest runs of spilled rows are merged above this amount of runs
+const size_t SPILL_MAX_RUNS = 16;
+const int SPILL_MERGED_RUNS = 8;
+
 IrredundantMatrix::IrredundantMatrix(int width)
-    : _width(width)
+    : _width(width),
+      _sampledRows(0),
+      _sampledNonzero(0),
+      _sparseRows(false)
 #ifdef USE_LOCAL_LOCK
     , _rSync(ATOMIC_FLAG_INIT)
+#else
+    , _memoryLimit(0)
+    , _runsCounter(0)
 #endif
 {
     _r.resize(width);
 }
 
+IrredundantMatrix::~IrredundantMatrix()
+{
+    clear();
+}
+
 
-void IrredundantMatrix::addRow(Row&& row, int* r)
+void IrredundantMatrix::addRow(Row&& row, const weight_t* r)
 {
+    addWeights(r);
+    addRowInternal(std::move(row));
+}
+
+void IrredundantMatrix::addWeights(const weight_t* r)
+{
+    if(r == nullptr) {
+        return;
+    }
+
     for(auto i=0; i<_width; ++i) {
         _r[i] += r[i];
     }
+}
 
-    addRowInternal(std::move(row));
+void IrredundantMatrix::chooseRowForm(Row& row)
+{
+    if (_width < SPARSE_MIN_WIDTH) {
+        return;
+    }
+
+    // Form is chosen once, rows which are already stored keep their form
+    if (!_sparseRows && _sampledRows < SPARSE_SAMPLE_ROWS) {
+        _sampledNonzero += row.getNonzeroCount();
+        if (++_sampledRows == SPARSE_SAMPLE_ROWS) {
+            _sparseRows = _sampledNonzero * SPARSE_DENSITY_DIVISOR <= static_cast<long>(SPARSE_SAMPLE_ROWS) * _width;
+            DEBUG_INFO("IrredundantMatrix: " << (_sparseRows ? "sparse" : "dense") << " rows, "
+                       << _sampledNonzero << " nonzero values in " << SPARSE_SAMPLE_ROWS << " rows");
+        }
+    }
+
+    if (_sparseRows) {
+        row.pack();
+    }
+}
+
+void IrredundantMatrix::restore(const std::vector<int>& rows, const std::vector<weight_t>& r)
+{
+    clear();
+    addWeights(r.data());
+
+    for(size_t i = 0; i < rows.size(); i += _width) {
+        Row row(_width);
+        for(auto j = 0; j < _width; ++j) {
+            row.setValue(j, rows[i + j]);
+        }
+        addRowInternal(std::move(row));
+    }
+}
+
+void IrredundantMatrix::load(const DataFile& datafile)
+{
+    if (datafile.getUimWeights() != nullptr) {
+        addWeights(datafile.getUimWeights());
+    }
+
+    auto uim = datafile.getUimSet();
+    for(size_t i = 0; i < datafile.getUimSetLen(); ++i) {
+        Row row(_width);
+        for(auto j = 0; j < _width; ++j) {
+            row.setValue(j, uim[i * _width + j]);
+        }
+        addRowInternal(std::move(row));
+    }
+}
+
+void IrredundantMatrix::setFeatureMapping(const std::vector<int>& mapping)
+{
+    _featureMapping = mapping;
+}
+
+void IrredundantMatrix::fill(DataFile& datafile)
+{
+    std::vector<int> rows;
+    std::vector<weight_t> r;
+    snapshot(rows, r);
+
+    auto height = rows.size() / _width;
+    if (_featureMapping.empty()) {
+        auto uim = new feature_t[rows.size()];
+        std::copy(rows.begin(), rows.end(), uim);
+
+        auto uimWeights = new weight_t[_width];
+        std::copy(r.begin(), r.end(), uimWeights);
+
+        datafile.setUimBlock(uim, height, _width);
+        datafile.setUimWeightsBlock(uimWeights, _width);
+        return;
+    }
+
+    // Skipped features are expanded back to the width of input data
+    int width = _featureMapping.size();
+    auto uim = new feature_t[height * width];
+    for(size_t i = 0; i < height; ++i) {
+        for(auto j = 0; j < width; ++j) {
+            auto col = _featureMapping[j];
+            uim[i * width + j] = col >= 0 ? rows[i * _width + col] : 0;
+        }
+    }
+
+    auto uimWeights = new weight_t[width];
+    for(auto j = 0; j < width; ++j) {
+        auto col = _featureMapping[j];
+        uimWeights[j] = col >= 0 ? r[col] : 0;
+    }
+
+    datafile.setUimBlock(uim, height, width);
+    datafile.setUimWeightsBlock(uimWeights, width);
 }
 
 #ifdef USE_LOCAL_LOCK
 
-void IrredundantMatrix::addRowConcurrent(Row&& row, int* r)
+void IrredundantMatrix::addRowConcurrent(Row&& row, const weight_t* r)
 {
     START_COLLECT_TIME(crossThreading, Counters::CrossThreading);
     while (_rSync.test_and_set(std::memory_order_acquire));
@@ -56,8 +185,16 @@ void IrredundantMatrix::addMatrixConcurrent(IrredundantMatrix &&matrix)
     }
 }
 
+void IrredundantMatrix::setMemoryLimit(size_t memoryLimit, const std::string& tempDir)
+{
+    if (memoryLimit > 0) {
+        throw std::runtime_error("Memory limit of irredundant matrix isn't supported with local locks");
+    }
+}
+
 void IrredundantMatrix::addRowInternal(Row &&row) {
     START_COLLECT_TIME(rMerging, Counters::RMerging);
+    chooseRowForm(row);
 
     IrredundantRowNode* start = nullptr;
     auto ageBoundMin = 0;
@@ -146,34 +283,26 @@ void IrredundantMatrix::clear()
     }
 }
 
-void IrredundantMatrix::fill(DataFile& datafile)
+void IrredundantMatrix::snapshot(std::vector<int>& rows, std::vector<weight_t>& r)
 {
-    auto height = 0;
-    for(auto current = _head.next; current != nullptr; current = current->next) {
-        height += 1;
-    }
-
-    auto i = 0;
-    auto uim = new feature_t[height * _width];
+    rows.clear();
     for(auto current = _head.next; current != nullptr; current = current->next) {
-        for(auto j = 0; j < _width; ++j) {
-            uim[i * _width + j] = current->data.getValue(j);
-        }
-        i += 1;
+        rows.resize(rows.size() + _width);
+        current->data.copyTo(rows.data() + rows.size() - _width);
     }
 
-    auto uimWeights = new feature_t[_width];
-    for(size_t j = 0; j < _width; ++j) {
-        uimWeights[j] = _r[j];
-    }
-
-    datafile.setUimBlock(uim, height, _width);
-    datafile.setUimWeightsBlock(uimWeights, _width);
+    r = _r;
 }
 
 #else
 
-void IrredundantMatrix::addRowConcurrent(Row&& row, int* r)
+void IrredundantMatrix::setMemoryLimit(size_t memoryLimit, const std::string& tempDir)
+{
+    _memoryLimit = memoryLimit;
+    _tempDir = tempDir;
+}
+
+void IrredundantMatrix::addRowConcurrent(Row&& row, const weight_t* r)
 {
     START_COLLECT_TIME(crossThreading, Counters::CrossThreading);
     _rMutex.lock();
@@ -214,6 +343,17 @@ void IrredundantMatrix::addMatrixConcurrent(IrredundantMatrix &&matrix)
         addRowInternal(std::move(*i));
     }
 
+    for(auto& run : matrix._runs) {
+        std::vector<Row> rows;
+        run.read(rows);
+        run.remove();
+
+        for(auto& row : rows) {
+            addRowInternal(std::move(row));
+        }
+    }
+    matrix._runs.clear();
+
     _rowsMutex.unlock();
 }
 
@@ -224,30 +364,141 @@ void IrredundantMatrix::clear()
     }
 
     _rows.clear();
+
+    for(auto& run : _runs) {
+        run.remove();
+    }
+    _runs.clear();
 }
 
-void IrredundantMatrix::fill(DataFile& datafile)
+void IrredundantMatrix::snapshot(std::vector<int>& rows, std::vector<weight_t>& r)
 {
-    auto uim = new feature_t[_rows.size() * _width];
-    for(auto i = 0; i < _rows.size(); ++i) {
-        for(auto j = 0; j < _width; ++j) {
-            uim[i * _width + j] = _rows[i].getValue(j);
+    std::vector<Row> spilledRows;
+    for(auto& run : _runs) {
+        run.read(spilledRows);
+    }
+
+    rows.clear();
+    rows.reserve((_rows.size() + spilledRows.size()) * _width);
+    for(auto i = _rows.begin(); i != _rows.end(); ++i) {
+        rows.resize(rows.size() + _width);
+        i->copyTo(rows.data() + rows.size() - _width);
+    }
+    for(auto i = spilledRows.begin(); i != spilledRows.end(); ++i) {
+        rows.resize(rows.size() + _width);
+        i->copyTo(rows.data() + rows.size() - _width);
+    }
+
+    r = _r;
+}
+
+bool IrredundantMatrix::isIncludedInRuns(const Row& row, long sum, calc_hash_t signature)
+{
+    _spillValues.resize(_width);
+    row.copyTo(_spillValues.data());
+
+    for(auto& run : _runs) {
+        if(run.isIncluding(_spillValues.data(), sum, signature)) {
+            return true;
         }
     }
 
-    auto uimWeights = new feature_t[_width];
-    for(size_t j = 0; j < _width; ++j) {
-        uimWeights[j] = _r[j];
+    return false;
+}
+
+void IrredundantMatrix::removeIncludedFromRuns(const Row& row, long sum, calc_hash_t signature)
+{
+    _spillValues.resize(_width);
+    row.copyTo(_spillValues.data());
+
+    auto run = _runs.begin();
+    while(run != _runs.end()) {
+        run->removeIncluded(_spillValues.data(), sum, signature);
+
+        if(run->getSize() == 0) {
+            run->remove();
+            run = _runs.erase(run);
+            continue;
+        }
+        ++run;
     }
+}
 
-    datafile.setUimBlock(uim, _rows.size(), _width);
-    datafile.setUimWeightsBlock(uimWeights, _width);
+std::string IrredundantMatrix::getRunPath()
+{
+    std::stringstream path;
+    path << _tempDir << "/uim_spill_" << getpid() << "_" << this << "_" << _runsCounter++ << ".bin";
+    return path.str();
+}
+
+void IrredundantMatrix::spillRows()
+{
+    auto rowMemory = sizeof(Row) + _width * sizeof(int) + 2 * sizeof(void*);
+    if(_memoryLimit == 0 || _rows.size() * rowMemory <= _memoryLimit) {
+        return;
+    }
+
+    // The oldest half of rows is considered as cold segment
+    auto count = _rows.size() / 2;
+    if(count == 0) {
+        return;
+    }
+#ifdef IRREDUNTANT_VECTOR
+    auto begin = _rows.begin();
+#else
+    auto begin = _rows.end() - count;
+#endif
+
+    std::vector<Row> rows;
+    rows.reserve(count);
+    for(auto i = begin; i != begin + count; ++i) {
+        rows.push_back(std::move(*i));
+    }
+    _rows.erase(begin, begin + count);
+
+    auto path = getRunPath();
+    DEBUG_INFO("-SP " << count << " rows to " << path);
+
+    _runs.push_back(SpillRun(path, _width));
+    _runs.back().write(rows);
+
+    mergeRuns();
+}
+
+// Every row is checked against every run, so the smallest runs are merged
+// when there are too many of them; this also bounds the amount of open files
+void IrredundantMatrix::mergeRuns()
+{
+    if(_runs.size() <= SPILL_MAX_RUNS) {
+        return;
+    }
+
+    std::sort(_runs.begin(), _runs.end(), [](const SpillRun& first, const SpillRun& second) {
+        return first.getSize() < second.getSize();
+    });
+
+    std::vector<SpillRun> runs;
+    for(auto i = 0; i < SPILL_MERGED_RUNS; ++i) {
+        runs.push_back(std::move(_runs[i]));
+    }
+    _runs.erase(_runs.begin(), _runs.begin() + SPILL_MERGED_RUNS);
+
+    auto path = getRunPath();
+    DEBUG_INFO("-SM " << runs.size() << " runs to " << path);
+
+    SpillRun merged(path, _width);
+    merged.merge(runs);
+    for(auto& run : runs) {
+        run.remove();
+    }
+    _runs.push_back(std::move(merged));
 }
 
 #ifdef IRREDUNTANT_VECTOR
 
 void IrredundantMatrix::addRowInternal(Row &&row) {
     START_COLLECT_TIME(rMerging, Counters::RMerging);
+    chooseRowForm(row);
 
     auto i = 0;
     while(i < _rows.size()) {
@@ -266,8 +517,20 @@ void IrredundantMatrix::addRowInternal(Row &&row) {
         ++i;
     }
 
+    if(!_runs.empty()) {
+        auto sum = row.getSum();
+        auto signature = row.getSignature();
+
+        if(isIncludedInRuns(row, sum, signature)) {
+            DEBUG_INFO("-CB " << row << " | spilled");
+            return;
+        }
+        removeIncludedFromRuns(row, sum, signature);
+    }
+
     DEBUG_INFO("-AR " << row);
     _rows.push_back(std::move(row));
+    spillRows();
 
     STOP_COLLECT_TIME(rMerging);
 }
@@ -276,6 +539,7 @@ void IrredundantMatrix::addRowInternal(Row &&row) {
 
 void IrredundantMatrix::addRowInternal(Row &&row) {
     START_COLLECT_TIME(rMerging, Counters::RMerging);
+    chooseRowForm(row);
 
     auto i = _rows.begin();
     while(i != _rows.end()) {
@@ -291,8 +555,20 @@ void IrredundantMatrix::addRowInternal(Row &&row) {
         ++i;
     }
 
+    if(!_runs.empty()) {
+        auto sum = row.getSum();
+        auto signature = row.getSignature();
+
+        if(isIncludedInRuns(row, sum, signature)) {
+            DEBUG_INFO("-CB " << row << " | spilled");
+            return;
+        }
+        removeIncludedFromRuns(row, sum, signature);
+    }
+
     DEBUG_INFO("-AR " << row);
     _rows.push_front(std::move(row));
+    spillRows();
 
     STOP_COLLECT_TIME(rMerging);
 }
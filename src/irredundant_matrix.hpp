@@ -1,8 +1,10 @@
 #ifndef IRREDUNDANTMATRIX_H
 #define IRREDUNDANTMATRIX_H
 
+#include <atomic>
 #include <iostream>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #ifndef IRREDUNTANT_VECTOR
@@ -11,9 +13,9 @@
 
 #include "row.hpp"
 #include "datafile.hpp"
+#include "spill_run.hpp"
 
 #ifdef USE_LOCAL_LOCK
-#include <atomic>
 
 struct IrredundantRowNode
 {
@@ -33,18 +35,42 @@ class IrredundantMatrix
 
 public:
     IrredundantMatrix(int width);
-    void addRow(Row&& row, int* r);
-    void addRowConcurrent(Row&& row, int* r);
+    ~IrredundantMatrix();
+
+    void setMemoryLimit(size_t memoryLimit, const std::string& tempDir);
+    void addRow(Row&& row, const weight_t* r);
+    void addWeights(const weight_t* r);
+    void addRowConcurrent(Row&& row, const weight_t* r);
     void addMatrixConcurrent(IrredundantMatrix&& matrix);
     void clear();
+    void load(const DataFile& dataFile);
+    void setFeatureMapping(const std::vector<int>& mapping);
     void fill(DataFile& dataFile);
 
+    // Not thread safe, rows aren't allowed to be changed during the calls
+    void snapshot(std::vector<int>& rows, std::vector<weight_t>& r);
+    void restore(const std::vector<int>& rows, const std::vector<weight_t>& r);
+
+    inline int getWidth() const
+    {
+        return _width;
+    }
+
     IrredundantMatrix(IrredundantMatrix& matrix) = delete;
     IrredundantMatrix& operator=(IrredundantMatrix& matrix) = delete;
 
 private:
 
     void addRowInternal(Row &&row);
+    void chooseRowForm(Row& row);
+
+#ifndef USE_LOCAL_LOCK
+    bool isIncludedInRuns(const Row& row, long sum, calc_hash_t signature);
+    void removeIncludedFromRuns(const Row& row, long sum, calc_hash_t signature);
+    void spillRows();
+    void mergeRuns();
+    std::string getRunPath();
+#endif
 
 #ifdef USE_LOCAL_LOCK
     IrredundantRowNode _head;
@@ -60,10 +86,21 @@ private:
     std::deque<Row> _rows;
 #endif
 
+    size_t _memoryLimit;
+    std::string _tempDir;
+    std::vector<SpillRun> _runs;
+    std::vector<int> _spillValues;
+    int _runsCounter;
+
 #endif
 
     int _width;
-    std::vector<int> _r;
+    std::vector<weight_t> _r;
+    std::vector<int> _featureMapping;
+
+    std::atomic<int> _sampledRows;
+    std::atomic<long> _sampledNonzero;
+    std::atomic<bool> _sparseRows;
 
 };
 
@@ -5,16 +5,14 @@
 #include "global_settings.h"
 #include "timecollector.hpp"
 
-ManyWorkersPlan::ManyWorkersPlan(int* counts, int len)
-    : _emptyTask(new ManyWorkersTask(0, 0, 0, true)),
+ManyWorkersPlan::ManyWorkersPlan(const PairTiles& tiles)
+    : _emptyTask(new ManyWorkersTask(0, PairTile(0, 0, 0, 0, 0), true)),
     _current(0)
 {
     START_COLLECT_TIME(planBuilding, Counters::PlanBuilding);
 
-    for(auto i=0; i<len-1; ++i) {
-        for(auto j=i+1; j<len; ++j) {
-            _tasks.push_back(ManyWorkersTask(i, j, counts[i] * counts[j], false));
-        }
+    for(auto id=0; id<tiles.getTilesCount(); ++id) {
+        _tasks.push_back(ManyWorkersTask(id, tiles.getTile(id), false));
     }
 
     std::sort(_tasks.begin(), _tasks.end(),
@@ -27,7 +25,7 @@ ManyWorkersPlan::ManyWorkersPlan(int* counts, int len)
        getDebugStream() << "ManyWorkersPlan: " << std::endl;
        for(auto i=0; i<_tasks.size(); ++i) {
            auto &task = _tasks[i];
-           getDebugStream() << task.getFirst() << "-" << task.getSecond() << ":" << task.getWeight() << std::endl;
+           getDebugStream() << task.getFirst() << "-" << task.getSecond() << "+" << task.getOffset() << ":" << task.getWeight() << std::endl;
        }
     )
 
@@ -4,23 +4,37 @@
 #include <vector>
 #include <mutex>
 
+#include "pair_tiles.hpp"
+
 class ManyWorkersTask
 {
  public:
 
-    ManyWorkersTask(int first, int second, int weight, bool isEmpty)
-        : _first(first), _second(second), _weight(weight), _isEmpty(isEmpty) { }
+    ManyWorkersTask(int id, const PairTile& tile, bool isEmpty)
+        : _id(id), _tile(tile), _isEmpty(isEmpty) { }
+
+    int getId() const {
+        return _id;
+    }
 
     int getFirst() const {
-        return _first;
+        return _tile.getFirst();
     }
 
     int getSecond() const {
-        return _second;
+        return _tile.getSecond();
+    }
+
+    int getOffset() const {
+        return _tile.getOffset();
+    }
+
+    int getLength() const {
+        return _tile.getLength();
     }
 
-    int getWeight() const {
-        return _weight;
+    long long getWeight() const {
+        return _tile.getWeight();
     }
 
     int isEmpty() const {
@@ -29,9 +43,8 @@ class ManyWorkersTask
 
  private:
 
-    int _first;
-    int _second;
-    int _weight;
+    int _id;
+    PairTile _tile;
     bool _isEmpty;
 
 };
@@ -39,7 +52,7 @@ class ManyWorkersTask
 class ManyWorkersPlan
 {
  public:
-    ManyWorkersPlan(int* counts, int len);
+    ManyWorkersPlan(const PairTiles& tiles);
     ~ManyWorkersPlan();
 
     ManyWorkersTask* getTask();
@@ -0,0 +1,47 @@
+#include "pair_tiles.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+#include "global_settings.h"
+#include "timecollector.hpp"
+
+PairTiles::PairTiles(const int* counts, int len, long long tileWeight)
+    : _len(len), _totalWeight(0)
+{
+    tileWeight = std::max(1LL, tileWeight);
+
+    for(auto i=0; i<len-1; ++i) {
+        for(auto j=i+1; j<len; ++j) {
+            _pairBegins.push_back(_tiles.size());
+
+            auto weight = static_cast<long long>(counts[i]) * counts[j];
+            auto parts = static_cast<int>(std::min<long long>(counts[i], (weight + tileWeight - 1) / tileWeight));
+
+            for(auto part=0; part<parts; ++part) {
+                auto begin = static_cast<int>(static_cast<long long>(counts[i]) * part / parts);
+                auto end = static_cast<int>(static_cast<long long>(counts[i]) * (part + 1) / parts);
+                _tiles.push_back(PairTile(i, j, begin, end - begin,
+                                          static_cast<long long>(end - begin) * counts[j]));
+            }
+
+            if (_tiles.size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+                throw std::runtime_error("Too many tiles of class pairs, increase tile size");
+            }
+            _totalWeight += weight;
+        }
+    }
+    _pairBegins.push_back(_tiles.size());
+
+    DEBUG_INFO("PairTiles: " << _tiles.size() << " tiles, " << _totalWeight << " pairs");
+}
+
+size_t PairTiles::getPairId(int first, int second) const
+{
+    if (first > second) {
+        std::swap(first, second);
+    }
+
+    return static_cast<size_t>(first) * (2 * static_cast<size_t>(_len) - first - 1) / 2 + (second - first - 1);
+}
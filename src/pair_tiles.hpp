@@ -0,0 +1,87 @@
+#ifndef PAIR_TILES_H
+#define PAIR_TILES_H
+
+#include <cstddef>
+#include <vector>
+
+class PairTile
+{
+ public:
+
+    PairTile(int first, int second, int offset, int length, long long weight)
+        : _first(first), _second(second), _offset(offset), _length(length), _weight(weight) { }
+
+    int getFirst() const {
+        return _first;
+    }
+
+    int getSecond() const {
+        return _second;
+    }
+
+    // Range of rows of the first class, the second class is taken entirely
+    int getOffset() const {
+        return _offset;
+    }
+
+    int getLength() const {
+        return _length;
+    }
+
+    long long getWeight() const {
+        return _weight;
+    }
+
+ private:
+
+    int _first;
+    int _second;
+    int _offset;
+    int _length;
+    long long _weight;
+
+};
+
+// Enumerates class pairs in the order of single thread algorithm and splits
+// every pair into tiles of at most tileWeight row pairs. Tiles depend only
+// on class sizes, so their indexes are stable between runs
+class PairTiles
+{
+ public:
+    PairTiles(const int* counts, int len, long long tileWeight);
+
+    int getTilesCount() const {
+        return _tiles.size();
+    }
+
+    const PairTile& getTile(int id) const {
+        return _tiles[id];
+    }
+
+    const std::vector<PairTile>& getTiles() const {
+        return _tiles;
+    }
+
+    // Tiles of the class pair are [getPairBegin, getPairEnd)
+    int getPairBegin(int first, int second) const {
+        return _pairBegins[getPairId(first, second)];
+    }
+
+    int getPairEnd(int first, int second) const {
+        return _pairBegins[getPairId(first, second) + 1];
+    }
+
+    long long getTotalWeight() const {
+        return _totalWeight;
+    }
+
+ private:
+    size_t getPairId(int first, int second) const;
+
+    int _len;
+    long long _totalWeight;
+    std::vector<PairTile> _tiles;
+    std::vector<int> _pairBegins;
+};
+
+#endif // PAIR_TILES_H
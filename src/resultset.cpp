@@ -1,14 +1,75 @@
 #include "resultset.hpp"
 
-#include <numeric>
+#include <algorithm>
+
+#include "cpu_dispatch.hpp"
+
+// Results are tested by blocks without branches, so blocks are vectorized
+const set_size_t SCAN_BLOCK = 8;
+
+// Returns the first index in [begin, end) of result which is a subset of
+// words, or a superset of them for Superset, and end when there isn't any
+template<feature_size_t WordsLen, bool Superset>
+static ISA_INLINE set_size_t findIncluding(const feature_word_t* results, set_size_t begin, set_size_t end,
+                                           const feature_word_t* words, feature_size_t wordsLen) {
+    auto len = FeatureWords<WordsLen>::getLen(wordsLen);
+
+    auto index = begin;
+    for (; index + SCAN_BLOCK <= end; index += SCAN_BLOCK) {
+        feature_word_t rests[SCAN_BLOCK];
+        for (set_size_t k = 0; k < SCAN_BLOCK; ++k) {
+            auto result = &results[static_cast<size_t>(index + k) * len];
+            feature_word_t rest = 0;
+            for (feature_size_t w = 0; w < len; ++w) {
+                rest |= Superset ? words[w] & ~result[w] : result[w] & ~words[w];
+            }
+            rests[k] = rest;
+        }
+
+        feature_word_t found = 0;
+        for (set_size_t k = 0; k < SCAN_BLOCK; ++k) {
+            found |= rests[k] == 0;
+        }
+        if (found) {
+            for (set_size_t k = 0; k < SCAN_BLOCK; ++k) {
+                if (rests[k] == 0) {
+                    return index + k;
+                }
+            }
+        }
+    }
+
+    for (; index < end; ++index) {
+        auto result = &results[static_cast<size_t>(index) * len];
+        if (Superset ? FeatureWords<WordsLen>::isSubset(words, result, len)
+                     : FeatureWords<WordsLen>::isSubset(result, words, len)) {
+            return index;
+        }
+    }
+    return end;
+}
+
+template<feature_size_t WordsLen>
+struct ResultsScan {
+    ISA_VARIANTS(findSubset, set_size_t,
+                 (const feature_word_t* results, set_size_t begin, set_size_t end,
+                  const feature_word_t* words, feature_size_t wordsLen),
+                 (findIncluding<WordsLen, false>(results, begin, end, words, wordsLen)))
+
+    ISA_VARIANTS(findSuperset, set_size_t,
+                 (const feature_word_t* results, set_size_t begin, set_size_t end,
+                  const feature_word_t* words, feature_size_t wordsLen),
+                 (findIncluding<WordsLen, true>(results, begin, end, words, wordsLen)))
+};
 
 ResultSet::ResultSet(set_size_t limit, feature_size_t featuresLen) :
     _limit(limit),
     _featuresLen(featuresLen),
+    _wordsLen(getFeatureWordsLen(featuresLen)),
     _size(0),
-    _results(new test_feature_t[limit * featuresLen]),
+    _results(new test_feature_t[static_cast<size_t>(limit) * featuresLen]),
     _resultsCosts(new feature_size_t[limit]),
-    _resultsHashes(new calc_hash_t[limit]),
+    _resultsWords(new feature_word_t[static_cast<size_t>(limit) * getFeatureWordsLen(featuresLen)]),
     _costBarrier(featuresLen + 1)
 {
 }
@@ -16,101 +77,81 @@ ResultSet::ResultSet(set_size_t limit, feature_size_t featuresLen) :
 ResultSet::~ResultSet() {
     delete [] _results;
     delete [] _resultsCosts;
-    delete [] _resultsHashes;
+    delete [] _resultsWords;
 }
 
 bool ResultSet::append(test_feature_t* covering) {
-    feature_size_t cost = std::accumulate(&covering[0], &covering[_featuresLen], 0);
-    if (cost > _costBarrier) {
-        return false;
-    }
+    FEATURE_WORDS_DISPATCH(_wordsLen, return appendWords<WORDS>(covering));
+}
 
-    calc_hash_t hash = calcHash(covering);
+template<feature_size_t WordsLen>
+bool ResultSet::appendWords(test_feature_t* covering) {
+    typedef FeatureWords<WordsLen> Words;
 
-    set_size_t index = 0;
-    while (index < _size && _resultsCosts[index] <= cost) {
-        if (isInclude(&_results[index * _featuresLen], _resultsHashes[index],
-                      covering, hash)) {
-            return false;
-        }
-        index += 1;
-    }
+    feature_word_t words[Words::getLen(_wordsLen)];
+    Words::pack(covering, _featuresLen, words, _wordsLen);
 
-    while (index < _size) {
-        if (isInclude(covering, hash,
-                      &_results[index * _featuresLen], _resultsHashes[index])) {
-            for (set_size_t i = index; i < (_size - 1); ++i) {
-                for (feature_size_t j = 0; j < _featuresLen; ++j) {
-                    _results[i * _featuresLen + j] = _results[(i+1) * _featuresLen + j];
-                }
-                _resultsCosts[i] = _resultsCosts[i+1];
-                _resultsHashes[i] = _resultsHashes[i+1];
-            }
+    feature_size_t cost = Words::count(words, _wordsLen);
+    if (cost > _costBarrier) {
+        return false;
+    }
 
-            _size -= 1;
-            continue;
-        }
+    typedef ResultsScan<WordsLen> Scan;
+    static const IsaKernel<decltype(&Scan::findSubsetBaseline)> findSubset(ISA_KERNEL(Scan::findSubset));
+    static const IsaKernel<decltype(&Scan::findSupersetBaseline)> findSuperset(ISA_KERNEL(Scan::findSuperset));
 
-        index += 1;
+    // Results are sorted by costs, so only cheaper or equal ones can be
+    // contained in the covering and only more expensive ones can contain it
+    auto index = static_cast<set_size_t>(std::upper_bound(&_resultsCosts[0], &_resultsCosts[_size], cost) - _resultsCosts);
+    if (findSubset.get()(_resultsWords, 0, index, words, _wordsLen) != index) {
+        return false;
     }
 
-    index = _size;
-    for (set_size_t i = 0; i < _size; ++i) {
-        if (cost < _resultsCosts[i]) {
-            index = i;
+    for (;;) {
+        index = findSuperset.get()(_resultsWords, index, _size, words, _wordsLen);
+        if (index == _size) {
             break;
         }
+        remove(index);
     }
 
+    index = static_cast<set_size_t>(std::upper_bound(&_resultsCosts[0], &_resultsCosts[_size], cost) - _resultsCosts);
+
     if (index >= _limit) {
         return false;
     }
 
-    for (set_size_t i = std::min(_size, _limit-1); i > index; --i) {
-        for (feature_size_t j = 0; j < _featuresLen; ++j) {
-            _results[i * _featuresLen + j] = _results[(i-1) * _featuresLen + j];
-        }
-        _resultsCosts[i] = _resultsCosts[i-1];
-        _resultsHashes[i] = _resultsHashes[i-1];
-    }
-
-    for (feature_size_t j = 0; j < _featuresLen; ++j) {
-        _results[index * _featuresLen + j] = covering[j];
-    }
+    auto last = std::min(_size, _limit-1);
+    std::copy_backward(&_results[static_cast<size_t>(index) * _featuresLen],
+                       &_results[static_cast<size_t>(last) * _featuresLen],
+                       &_results[static_cast<size_t>(last + 1) * _featuresLen]);
+    std::copy_backward(&_resultsWords[static_cast<size_t>(index) * _wordsLen],
+                       &_resultsWords[static_cast<size_t>(last) * _wordsLen],
+                       &_resultsWords[static_cast<size_t>(last + 1) * _wordsLen]);
+    std::copy_backward(&_resultsCosts[index], &_resultsCosts[last], &_resultsCosts[last + 1]);
+
+    std::copy(&covering[0], &covering[_featuresLen], &_results[static_cast<size_t>(index) * _featuresLen]);
+    std::copy(&words[0], &words[Words::getLen(_wordsLen)], &_resultsWords[static_cast<size_t>(index) * _wordsLen]);
     _resultsCosts[index] = cost;
-    _resultsHashes[index] = hash;
 
     if (_size < _limit) {
         _size += 1;
-    } else {
+    }
+    if (_size == _limit) {
         _costBarrier = _resultsCosts[_limit - 1];
     }
 
     return true;
 }
 
-calc_hash_t ResultSet::calcHash(test_feature_t* first) const {
-    calc_hash_t temp = 0;
-    for (feature_size_t i = 0; i < _featuresLen; ++i) {
-        if (first[i]) {
-            temp |= 1 << (i % calc_hash_bits);
-        }
-    }
-    return temp;
-}
+void ResultSet::remove(set_size_t index) {
+    std::copy(&_results[static_cast<size_t>(index + 1) * _featuresLen],
+              &_results[static_cast<size_t>(_size) * _featuresLen],
+              &_results[static_cast<size_t>(index) * _featuresLen]);
+    std::copy(&_resultsWords[static_cast<size_t>(index + 1) * _wordsLen],
+              &_resultsWords[static_cast<size_t>(_size) * _wordsLen],
+              &_resultsWords[static_cast<size_t>(index) * _wordsLen]);
+    std::copy(&_resultsCosts[index + 1], &_resultsCosts[_size], &_resultsCosts[index]);
 
-bool ResultSet::isInclude(test_feature_t* first, calc_hash_t firstHash,
-                          test_feature_t* second, calc_hash_t secondHash) const {
-
-    if ((firstHash & secondHash) != firstHash) {
-        return false;
-    }
-
-    for (feature_size_t i = 0; i < _featuresLen; ++i) {
-        if (first[i] > second[i]) {
-            return false;
-        }
-    }
-
-    return true;
+    _size -= 1;
 }
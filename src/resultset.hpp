@@ -1,6 +1,7 @@
 #pragma once
 
 #include "global_settings.h"
+#include "feature_words.hpp"
 
 class ResultSet final {
 
@@ -16,20 +17,23 @@ class ResultSet final {
     inline set_size_t getSize() const { return _size; }
     inline set_size_t getLimit() const { return _limit; }
     inline feature_size_t getCostBarrier() const { return _costBarrier; }
-    inline test_feature_t* get(set_size_t index) const { return &_results[index * _featuresLen]; }
+    inline test_feature_t* get(set_size_t index) const { return &_results[static_cast<size_t>(index) * _featuresLen]; }
     inline bool isFull() const { return _size == _limit; }
 
  private:
-    bool isInclude(test_feature_t* first, calc_hash_t firstHash,
-                   test_feature_t* second, calc_hash_t secondHash) const;
-    calc_hash_t calcHash(test_feature_t* first) const;
+    template<feature_size_t WordsLen>
+    bool appendWords(test_feature_t* covering);
+
+    void remove(set_size_t index);
 
     test_feature_t* _results;
     feature_size_t* _resultsCosts;
-    calc_hash_t* _resultsHashes;
+    // Results packed to features words, containment is checked by them
+    feature_word_t* _resultsWords;
 
     set_size_t _size;
     feature_size_t _featuresLen;
+    feature_size_t _wordsLen;
     set_size_t _limit;
     feature_size_t _costBarrier;
 };
@@ -1,31 +1,84 @@
 #include "row.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 #include <limits>
 
 #include "global_settings.h"
+#include "cpu_dispatch.hpp"
 
 const int SKIP_VALUE = std::numeric_limits<int>::min();
 
+// Values are compared by blocks without branches, so blocks are vectorized
+const int DOMINANCE_BLOCK = 16;
+
+static ISA_INLINE void calcDifference(const int* first, const int* second, int width, int* outValues)
+{
+    for(auto i=0; i<width; ++i) {
+        // Difference is taken in unsigned values, skipped ones would
+        // overflow int
+        auto difference = static_cast<unsigned int>(std::max(first[i], second[i])) -
+                          static_cast<unsigned int>(std::min(first[i], second[i]));
+        auto skip = first[i] == SKIP_VALUE || second[i] == SKIP_VALUE;
+        outValues[i] = skip ? 0 : static_cast<int>(difference);
+    }
+}
+
+static ISA_INLINE bool isIncludeDense(const int* values, const int* rowValues, int width)
+{
+    auto i = 0;
+    for(; i + DOMINANCE_BLOCK <= width; i += DOMINANCE_BLOCK) {
+        auto greater = 0;
+        for(auto k=0; k<DOMINANCE_BLOCK; ++k) {
+            greater |= rowValues[i + k] < values[i + k];
+        }
+        if(greater) {
+            return false;
+        }
+    }
+
+    for(; i<width; ++i) {
+        if(rowValues[i] < values[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ISA_VARIANTS(calcDifferenceVariant, void,
+             (const int* first, const int* second, int width, int* outValues),
+             (calcDifference(first, second, width, outValues)))
+
+ISA_VARIANTS(isIncludeDenseVariant, bool,
+             (const int* values, const int* rowValues, int width),
+             (isIncludeDense(values, rowValues, width)))
+
+static const IsaKernel<decltype(&calcDifferenceVariantBaseline)> calcDifferenceKernel(ISA_KERNEL(calcDifferenceVariant));
+static const IsaKernel<decltype(&isIncludeDenseVariantBaseline)> isIncludeDenseKernel(ISA_KERNEL(isIncludeDenseVariant));
+
 Row::Row()
-    : _width(0),
-      _values(nullptr)
+    : _values(nullptr),
+      _width(0),
+      _size(0)
 {
 }
 
 Row::Row(int width)
-    : _width(width),
-      _values(new int[width])
+    : _values(new int[width]),
+      _width(width),
+      _size(width)
 {
 }
 
 Row::Row(Row &&row) {
     _values = row._values;
     _width = row._width;
+    _size = row._size;
 
     row._values = nullptr;
     row._width = 0;
+    row._size = 0;
 }
 
 Row& Row::operator=(Row &&row) {
@@ -34,9 +87,13 @@ Row& Row::operator=(Row &&row) {
 
     _values = row._values;
     _width = row._width;
+    _size = row._size;
 
     row._values = nullptr;
     row._width = 0;
+    row._size = 0;
+
+    return *this;
 }
 
 Row::~Row()
@@ -52,12 +109,7 @@ Row Row::createAsDifference(const WorkRow &w1, const WorkRow &w2)
         throw std::invalid_argument("Widths aren't equal");
 
     Row temp(w1.getWidth());
-    for(auto i=0; i<w1.getWidth(); ++i) {
-        if(w1.getValue(i) == SKIP_VALUE || w2.getValue(i) == SKIP_VALUE)
-            temp.setValue(i, 0);
-        else
-            temp.setValue(i, std::abs(w1.getValue(i) - w2.getValue(i)));
-    }
+    calcDifferenceKernel.get()(w1.getValues(), w2.getValues(), w1.getWidth(), temp._values);
     return temp;
 }
 
@@ -66,15 +118,170 @@ bool Row::isInclude(const Row &row) const
     if(getWidth() != row.getWidth())
         throw std::invalid_argument("Widths aren't equal");
 
-    for(auto i=0; i<getWidth(); ++i) {
-        if(row.getValue(i) < getValue(i)) {
-            return false;
+    if(_size == _width && row._size == row._width) {
+        return isIncludeDenseKernel.get()(_values, row._values, _width);
+    }
+
+    return isIncludeSparse(row);
+}
+
+bool Row::isIncludeSparse(const Row &row) const
+{
+    auto indexes = _values;
+    auto values = _values + _size;
+    auto rowIndexes = row._values;
+    auto rowValues = row._values + row._size;
+
+    if(!isSparse()) {
+        // Every nonzero value of this row should have a pair in sparse row
+        auto k = 0;
+        for(auto i=0; i<_width; ++i) {
+            if(_values[i] == 0) {
+                continue;
+            }
+            while(k < row._size && rowIndexes[k] < i) {
+                ++k;
+            }
+            if(k == row._size || rowIndexes[k] != i || rowValues[k] < _values[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if(!row.isSparse()) {
+        for(auto k=0; k<_size; ++k) {
+            if(row._values[indexes[k]] < values[k]) {
+                return false;
+            }
         }
+        return true;
     }
 
+    // Nonzero indexes of this row should be a subset of indexes of other row
+    if(_size > row._size) {
+        return false;
+    }
+
+    auto j = 0;
+    for(auto k=0; k<_size; ++k) {
+        while(j < row._size && rowIndexes[j] < indexes[k]) {
+            ++j;
+        }
+        if(j == row._size || rowIndexes[j] != indexes[k] || rowValues[j] < values[k]) {
+            return false;
+        }
+    }
     return true;
 }
 
+long Row::getSum() const
+{
+    auto values = isSparse() ? _values + _size : _values;
+
+    long sum = 0;
+    for(auto k=0; k<_size; ++k) {
+        sum += values[k];
+    }
+    return sum;
+}
+
+calc_hash_t Row::getSignature() const
+{
+    calc_hash_t signature = 0;
+    if(isSparse()) {
+        for(auto k=0; k<_size; ++k) {
+            signature |= static_cast<calc_hash_t>(1) << (_values[k] % calc_hash_bits);
+        }
+        return signature;
+    }
+
+    for(auto i=0; i<getWidth(); ++i) {
+        if(getValue(i) != 0) {
+            signature |= static_cast<calc_hash_t>(1) << (i % calc_hash_bits);
+        }
+    }
+    return signature;
+}
+
+int Row::getNonzeroCount() const
+{
+    if(isSparse()) {
+        return _size;
+    }
+
+    auto count = 0;
+    for(auto i=0; i<_width; ++i) {
+        if(_values[i] != 0) {
+            count += 1;
+        }
+    }
+    return count;
+}
+
+int Row::getSparseValue(int index) const
+{
+    auto position = std::lower_bound(_values, _values + _size, index);
+    if(position == _values + _size || *position != index) {
+        return 0;
+    }
+    return _values[_size + (position - _values)];
+}
+
+void Row::pack()
+{
+    if(isSparse() || _values == nullptr) {
+        return;
+    }
+
+    // Row without zeros can't be stored shorter
+    auto size = getNonzeroCount();
+    if(size == _width) {
+        return;
+    }
+
+    auto packed = new int[2 * size];
+    auto k = 0;
+    for(auto i=0; i<_width; ++i) {
+        if(_values[i] != 0) {
+            packed[k] = i;
+            packed[size + k] = _values[i];
+            ++k;
+        }
+    }
+
+    delete[] _values;
+    _values = packed;
+    _size = size;
+}
+
+void Row::unpack()
+{
+    if(!isSparse()) {
+        return;
+    }
+
+    auto values = new int[_width];
+    copyTo(values);
+
+    delete[] _values;
+    _values = values;
+    _size = _width;
+}
+
+void Row::copyTo(int* values) const
+{
+    if(!isSparse()) {
+        std::copy(_values, _values + _width, values);
+        return;
+    }
+
+    std::fill(values, values + _width, 0);
+    for(auto k=0; k<_size; ++k) {
+        values[_values[k]] = _values[_size + k];
+    }
+}
+
 std::ostream& operator<<(std::ostream& stream, const Row& row)
 {
     for(auto i=0; i<row.getWidth(); ++i) {
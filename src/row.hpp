@@ -4,6 +4,7 @@
 #include <utility>
 #include <iostream>
 
+#include "global_settings.h"
 #include "workrow.hpp"
 
 class Row
@@ -23,12 +24,26 @@ public:
 public:
     static Row createAsDifference(const WorkRow& w1, const WorkRow& w2);
     bool isInclude(const Row& row) const;
+    long getSum() const;
+    calc_hash_t getSignature() const;
     friend std::ostream& operator<<(std::ostream& stream, const Row& row);
 
+    // Sparse form keeps only nonzero values with their sorted indexes,
+    // values of a row are expected to be non-negative
+    void pack();
+    void unpack();
+    void copyTo(int* values) const;
+    int getNonzeroCount() const;
+
+    inline bool isSparse() const {
+        return _size != _width;
+    }
+
     inline int getValue(int index) const {
-        return _values[index];
+        return _size == _width ? _values[index] : getSparseValue(index);
     }
 
+    // Only for dense form
     inline void setValue(int index, int value) {
         _values[index] = value;
     }
@@ -38,8 +53,15 @@ public:
     }
 
 private:
+    int getSparseValue(int index) const;
+    bool isIncludeSparse(const Row& row) const;
+
+private:
+    // Dense form: _size == _width values,
+    // sparse form: _size indexes followed by _size values
     int* _values;
     int _width;
+    int _size;
 };
 
 #endif // ROW_H
@@ -0,0 +1,48 @@
+#include "shard_plan.hpp"
+
+#include <algorithm>
+
+#include "global_settings.h"
+#include "timecollector.hpp"
+
+// Every shard gets at least this amount of tiles when class pairs allow it
+const int TILES_PER_SHARD = 4;
+
+ShardPlan::ShardPlan(const int* counts, int len, int shardsCount)
+    : _shards(shardsCount), _weights(shardsCount, 0)
+{
+    START_COLLECT_TIME(planBuilding, Counters::PlanBuilding);
+
+    long long totalWeight = 0;
+    for(auto i=0; i<len-1; ++i) {
+        for(auto j=i+1; j<len; ++j) {
+            totalWeight += static_cast<long long>(counts[i]) * counts[j];
+        }
+    }
+
+    auto tileWeight = std::max(1LL, totalWeight / (static_cast<long long>(shardsCount) * TILES_PER_SHARD));
+    auto tiles = PairTiles(counts, len, tileWeight).getTiles();
+
+    // Greedy assignment of the heaviest tile to the least loaded shard,
+    // stable sort keeps the result deterministic for equal weights
+    std::stable_sort(tiles.begin(), tiles.end(),
+                     [](const PairTile &a, const PairTile &b) -> bool
+                     {
+                         return a.getWeight() > b.getWeight();
+                     });
+
+    for(auto& tile : tiles) {
+        auto shard = std::min_element(_weights.begin(), _weights.end()) - _weights.begin();
+        _shards[shard].push_back(tile);
+        _weights[shard] += tile.getWeight();
+    }
+
+    DEBUG_BLOCK (
+       getDebugStream() << "ShardPlan: " << std::endl;
+       for(auto shard=0; shard<shardsCount; ++shard) {
+           getDebugStream() << shard << ": " << _shards[shard].size() << " tiles, " << _weights[shard] << std::endl;
+       }
+    )
+
+    STOP_COLLECT_TIME(planBuilding);
+}
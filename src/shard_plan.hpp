@@ -0,0 +1,29 @@
+#ifndef SHARD_PLAN_H
+#define SHARD_PLAN_H
+
+#include <vector>
+
+#include "pair_tiles.hpp"
+
+// Splits class pairs into tiles and distributes them between shards by weight.
+// The plan depends only on class sizes, so independent processes build
+// the same plan for the same input
+class ShardPlan
+{
+ public:
+    ShardPlan(const int* counts, int len, int shardsCount);
+
+    const std::vector<PairTile>& getTiles(int shard) const {
+        return _shards[shard];
+    }
+
+    long long getShardWeight(int shard) const {
+        return _weights[shard];
+    }
+
+ private:
+    std::vector<std::vector<PairTile>> _shards;
+    std::vector<long long> _weights;
+};
+
+#endif // SHARD_PLAN_H
@@ -0,0 +1,315 @@
+#include "spill_run.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Rows of a run are summarized by blocks of this amount of rows
+const int SPILL_BLOCK_ROWS = 1024;
+
+// Record of a row is the header followed by dense values of the row
+struct SpillRecordHeader
+{
+    int64_t sum;
+    calc_hash_t signature;
+};
+
+static inline SpillRecordHeader getRecordHeader(const char* record)
+{
+    SpillRecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    return header;
+}
+
+static inline const int* getRecordValues(const char* record)
+{
+    return reinterpret_cast<const int*>(record + sizeof(SpillRecordHeader));
+}
+
+// Checks whether every value of first is not greater than the one of second
+static inline bool isNotGreater(const int* first, const int* second, int width)
+{
+    auto j = 0;
+    while(j < width && first[j] <= second[j]) {
+        ++j;
+    }
+    return j == width;
+}
+
+// Writes records to the file of a run block by block, the file is mapped
+// and blocks are summarized when it's finished
+class SpillRun::Writer
+{
+public:
+    Writer(SpillRun& run)
+        : _run(run),
+          _stream(run._path, std::ios::binary | std::ios::trunc),
+          _offset(0)
+    {
+        if(!_stream) {
+            throw std::runtime_error("Cannot write spill file " + run._path);
+        }
+
+        _run._mapping.reset();
+        _run._mappingSize = 0;
+        _run._blocks.clear();
+        _run._size = 0;
+    }
+
+    void add(const char* record)
+    {
+        auto& blocks = _run._blocks;
+        if(blocks.empty() || blocks.back().size == SPILL_BLOCK_ROWS) {
+            blocks.push_back(Block());
+            blocks.back().offset = _offset;
+            blocks.back().size = 0;
+        }
+
+        _stream.write(record, _run._recordSize);
+        _offset += _run._recordSize;
+        blocks.back().size += 1;
+        _run._size += 1;
+    }
+
+    void finish()
+    {
+        _stream.close();
+        if(!_stream) {
+            throw std::runtime_error("Cannot write spill file " + _run._path);
+        }
+
+        _run._mappingSize = _offset;
+        _run.map();
+        for(auto& block : _run._blocks) {
+            _run.summarizeBlock(block);
+        }
+    }
+
+private:
+    SpillRun& _run;
+    std::ofstream _stream;
+    size_t _offset;
+};
+
+SpillRun::SpillRun(const std::string& path, int width)
+    : _path(path),
+      _width(width),
+      _size(0),
+      _recordSize(sizeof(SpillRecordHeader) + width * sizeof(int)),
+      _mappingSize(0)
+{
+}
+
+void SpillRun::map()
+{
+    if(_mappingSize == 0) {
+        _mapping.reset();
+        return;
+    }
+
+    auto fd = open(_path.c_str(), O_RDWR);
+    void* data = MAP_FAILED;
+    if(fd >= 0) {
+        // Removed rows are written back in place, so the mapping is shared
+        data = mmap(nullptr, _mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+
+    if(data == MAP_FAILED) {
+        throw std::runtime_error("Cannot map spill file " + _path);
+    }
+
+    auto size = _mappingSize;
+    _mapping.reset(static_cast<char*>(data), [size](char* data) { munmap(data, size); });
+}
+
+void SpillRun::summarizeBlock(Block& block) const
+{
+    block.minSum = getRecordHeader(getRecord(block, 0)).sum;
+    block.maxSum = getRecordHeader(getRecord(block, block.size - 1)).sum;
+    block.andSignature = ~static_cast<calc_hash_t>(0);
+    block.orSignature = 0;
+    block.minValues.assign(getRecordValues(getRecord(block, 0)), getRecordValues(getRecord(block, 0)) + _width);
+    block.maxValues = block.minValues;
+
+    for(auto k=0; k<block.size; ++k) {
+        auto record = getRecord(block, k);
+        auto signature = getRecordHeader(record).signature;
+        block.andSignature &= signature;
+        block.orSignature |= signature;
+
+        auto values = getRecordValues(record);
+        for(auto j=0; j<_width; ++j) {
+            block.minValues[j] = std::min(block.minValues[j], values[j]);
+            block.maxValues[j] = std::max(block.maxValues[j], values[j]);
+        }
+    }
+}
+
+void SpillRun::write(std::vector<Row>& rows)
+{
+    std::vector<std::pair<long, int>> order(rows.size());
+    for(size_t i=0; i<rows.size(); ++i) {
+        order[i] = std::make_pair(rows[i].getSum(), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    Writer writer(*this);
+    std::vector<char> record(_recordSize);
+    for(auto& item : order) {
+        auto& row = rows[item.second];
+        SpillRecordHeader header = {item.first, row.getSignature()};
+        std::memcpy(record.data(), &header, sizeof(header));
+        row.copyTo(const_cast<int*>(getRecordValues(record.data())));
+
+        writer.add(record.data());
+    }
+    writer.finish();
+}
+
+void SpillRun::read(std::vector<Row>& rows) const
+{
+    for(auto& block : _blocks) {
+        for(auto k=0; k<block.size; ++k) {
+            auto values = getRecordValues(getRecord(block, k));
+
+            Row row(_width);
+            for(auto j=0; j<_width; ++j) {
+                row.setValue(j, values[j]);
+            }
+            rows.push_back(std::move(row));
+        }
+    }
+}
+
+void SpillRun::merge(const std::vector<SpillRun>& runs)
+{
+    struct Cursor
+    {
+        const SpillRun* run;
+        size_t block;
+        int position;
+
+        inline const char* getRecord() const {
+            return run->getRecord(run->_blocks[block], position);
+        }
+    };
+
+    std::vector<Cursor> cursors;
+    for(auto& run : runs) {
+        if(!run._blocks.empty()) {
+            cursors.push_back(Cursor{&run, 0, 0});
+        }
+    }
+
+    Writer writer(*this);
+    while(!cursors.empty()) {
+        auto next = cursors.begin();
+        for(auto cursor = cursors.begin(); cursor != cursors.end(); ++cursor) {
+            if(getRecordHeader(cursor->getRecord()).sum < getRecordHeader(next->getRecord()).sum) {
+                next = cursor;
+            }
+        }
+
+        writer.add(next->getRecord());
+
+        if(++next->position == next->run->_blocks[next->block].size) {
+            next->position = 0;
+            if(++next->block == next->run->_blocks.size()) {
+                cursors.erase(next);
+            }
+        }
+    }
+    writer.finish();
+}
+
+bool SpillRun::isIncluding(const int* values, long sum, calc_hash_t signature) const
+{
+    for(auto& block : _blocks) {
+        // Rows which include the given one have not greater sums
+        if(block.minSum > sum) {
+            break;
+        }
+        if((block.andSignature & signature) != block.andSignature ||
+           !isNotGreater(block.minValues.data(), values, _width)) {
+            continue;
+        }
+
+        for(auto k=0; k<block.size; ++k) {
+            auto record = getRecord(block, k);
+            auto header = getRecordHeader(record);
+            if(header.sum > sum) {
+                break;
+            }
+            if((header.signature & signature) != header.signature) {
+                continue;
+            }
+
+            if(isNotGreater(getRecordValues(record), values, _width)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void SpillRun::removeIncluded(const int* values, long sum, calc_hash_t signature)
+{
+    auto block = _blocks.begin();
+    while(block != _blocks.end()) {
+        // Rows which are included by the given one have not less sums
+        if(block->maxSum < sum || (block->orSignature & signature) != signature ||
+           !isNotGreater(values, block->maxValues.data(), _width)) {
+            ++block;
+            continue;
+        }
+
+        // Remaining records are moved to the start of the block in place
+        auto kept = 0;
+        for(auto k=0; k<block->size; ++k) {
+            auto record = getRecord(*block, k);
+            auto header = getRecordHeader(record);
+
+            auto included = header.sum >= sum && (header.signature & signature) == signature &&
+                            isNotGreater(values, getRecordValues(record), _width);
+            if(!included) {
+                if(kept != k) {
+                    std::memmove(getRecord(*block, kept), record, _recordSize);
+                }
+                kept += 1;
+            }
+        }
+
+        if(kept == block->size) {
+            ++block;
+            continue;
+        }
+
+        _size -= block->size - kept;
+        block->size = kept;
+        if(kept == 0) {
+            block = _blocks.erase(block);
+            continue;
+        }
+
+        summarizeBlock(*block);
+        ++block;
+    }
+}
+
+void SpillRun::remove()
+{
+    _mapping.reset();
+    _mappingSize = 0;
+    std::remove(_path.c_str());
+
+    _blocks.clear();
+    _size = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef SPILLRUN_H
+#define SPILLRUN_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "global_settings.h"
+#include "row.hpp"
+
+// Sorted by row sum segment of irredundant matrix stored on disk. Rows are
+// written by blocks, summary of every block is kept in memory: bounds of
+// sums and values of rows, AND/OR signatures. So a check touches only
+// blocks which may include the row or be included by it. Every record keeps
+// sum and signature of its row, scan of a block stops at the sum of the
+// checked row and skips records by signature before comparing values.
+// File is mapped while the run exists, so pages of its hot blocks stay in
+// page cache between checks and are evicted under memory pressure
+class SpillRun
+{
+
+public:
+    SpillRun(const std::string& path, int width);
+
+    void write(std::vector<Row>& rows);
+    void read(std::vector<Row>& rows) const;
+    void remove();
+
+    // Rows of the runs are written to this one in order of sums
+    void merge(const std::vector<SpillRun>& runs);
+
+    // Checks whether some row of the run includes the dense row values
+    bool isIncluding(const int* values, long sum, calc_hash_t signature) const;
+
+    // Removes rows which are included by the dense row values
+    void removeIncluded(const int* values, long sum, calc_hash_t signature);
+
+    inline int getSize() const {
+        return _size;
+    }
+
+private:
+    struct Block
+    {
+        size_t offset;
+        int size;
+        long minSum;
+        long maxSum;
+        calc_hash_t andSignature;
+        calc_hash_t orSignature;
+        std::vector<int> minValues;
+        std::vector<int> maxValues;
+    };
+
+    class Writer;
+
+    void summarizeBlock(Block& block) const;
+    void map();
+
+    inline size_t getRecordSize() const {
+        return _recordSize;
+    }
+
+    inline char* getRecord(const Block& block, int index) const {
+        return _mapping.get() + block.offset + index * _recordSize;
+    }
+
+private:
+    std::string _path;
+    int _width;
+    int _size;
+    size_t _recordSize;
+
+    std::shared_ptr<char> _mapping;
+    size_t _mappingSize;
+    std::vector<Block> _blocks;
+};
+
+#endif // SPILLRUN_H
@@ -0,0 +1,136 @@
+#ifndef TEXT_SCANNER_H
+#define TEXT_SCANNER_H
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// Scanner of whitespace separated tokens of a text buffer. Numbers are
+// parsed in place, a single "-" is a dash and is returned as maximum value
+// of the type
+class TextScanner
+{
+public:
+    TextScanner(const char* begin, const char* end)
+        : _current(begin), _end(end) { }
+
+    inline const char* getPosition() const {
+        return _current;
+    }
+
+    inline void setPosition(const char* position) {
+        _current = position;
+    }
+
+    inline bool skipSpaces() {
+        while (_current != _end && isSpace(*_current)) {
+            ++_current;
+        }
+        return _current != _end;
+    }
+
+    inline std::string nextToken() {
+        if (!skipSpaces()) {
+            return std::string();
+        }
+
+        auto begin = _current;
+        while (_current != _end && !isSpace(*_current)) {
+            ++_current;
+        }
+        return std::string(begin, _current);
+    }
+
+    template<typename T>
+    inline T nextValue() {
+        if (!skipSpaces()) {
+            throw std::runtime_error("Cannot parse input, unexpected end of data");
+        }
+
+        auto begin = _current;
+        if (*_current == '-') {
+            ++_current;
+            if (_current == _end || isSpace(*_current)) {
+                return std::numeric_limits<T>::max();
+            }
+            throw std::runtime_error("Cannot parse input, unexpected value " + currentToken(begin));
+        }
+
+        unsigned long long value = 0;
+        while (_current != _end && isDigit(*_current)) {
+            value = value * 10 + (*_current - '0');
+            ++_current;
+        }
+
+        if (_current == begin || (_current != _end && !isSpace(*_current))) {
+            throw std::runtime_error("Cannot parse input, unexpected value " + currentToken(begin));
+        }
+
+        return static_cast<T>(value);
+    }
+
+    inline size_t countTokens() {
+        size_t count = 0;
+        while (skipSpaces()) {
+            count += 1;
+            while (_current != _end && !isSpace(*_current)) {
+                ++_current;
+            }
+        }
+        return count;
+    }
+
+    // Block headers are the only tokens ending with a colon,
+    // returns start of the next header or end of the buffer
+    inline const char* findHeader() const {
+        auto colon = static_cast<const char*>(std::memchr(_current, ':', _end - _current));
+        if (colon == nullptr) {
+            return _end;
+        }
+
+        while (colon != _current && !isSpace(colon[-1])) {
+            --colon;
+        }
+        return colon;
+    }
+
+    // Moves position from the middle of a token to its end,
+    // so that parts of a buffer split there contain whole tokens
+    static inline const char* alignToToken(const char* begin, const char* position, const char* end) {
+        while (position != begin && position != end && !isSpace(position[-1]) && !isSpace(*position)) {
+            ++position;
+        }
+        return position;
+    }
+
+    // Moves position back to the start of the token it's in
+    static inline const char* findTokenStart(const char* begin, const char* position) {
+        while (position != begin && !isSpace(position[-1])) {
+            --position;
+        }
+        return position;
+    }
+
+private:
+    static inline bool isSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+    }
+
+    static inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    inline std::string currentToken(const char* begin) {
+        while (_current != _end && !isSpace(*_current)) {
+            ++_current;
+        }
+        return std::string(begin, _current);
+    }
+
+    const char* _current;
+    const char* _end;
+};
+
+#endif // TEXT_SCANNER_H
@@ -0,0 +1,106 @@
+#ifndef TEXT_WRITER_H
+#define TEXT_WRITER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Formatter of text into a memory buffer. Numbers are formatted in place,
+// the buffer is written to the output stream when it grows over the flush
+// size. Writer without a stream only collects text, so that parts of the
+// output can be formatted separately and written in order later
+class TextWriter
+{
+public:
+    const static size_t FLUSH_SIZE = 1 << 20;
+
+    explicit TextWriter(std::ostream* outputStream = nullptr)
+        : _outputStream(outputStream), _buffer(FLUSH_SIZE + MAX_TOKEN_SIZE), _size(0) { }
+
+    inline size_t getSize() const {
+        return _size;
+    }
+
+    inline void clear() {
+        _size = 0;
+    }
+
+    inline void write(char c) {
+        reserve(1);
+        _buffer[_size++] = c;
+    }
+
+    inline void write(const char* text) {
+        write(text, std::strlen(text));
+    }
+
+    inline void write(const char* text, size_t length) {
+        reserve(length);
+        std::memcpy(_buffer.data() + _size, text, length);
+        _size += length;
+    }
+
+    inline void write(const TextWriter& writer) {
+        write(writer._buffer.data(), writer._size);
+    }
+
+    template<typename T>
+    inline void writeValue(T value) {
+        reserve(MAX_TOKEN_SIZE);
+
+        // Digits are produced by pairs from the end of the number
+        static const char* DIGIT_PAIRS =
+            "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+            "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+        char digits[MAX_TOKEN_SIZE];
+        auto end = digits + MAX_TOKEN_SIZE;
+        auto current = end;
+        auto number = static_cast<unsigned long long>(value);
+
+        while (number >= 100) {
+            auto pair = DIGIT_PAIRS + (number % 100) * 2;
+            number /= 100;
+            *--current = pair[1];
+            *--current = pair[0];
+        }
+        if (number >= 10) {
+            auto pair = DIGIT_PAIRS + number * 2;
+            *--current = pair[1];
+            *--current = pair[0];
+        } else {
+            *--current = static_cast<char>('0' + number);
+        }
+
+        std::memcpy(_buffer.data() + _size, current, end - current);
+        _size += end - current;
+    }
+
+    // Writes the whole buffer to the stream
+    inline void flush() {
+        if (_outputStream != nullptr && _size > 0) {
+            _outputStream->write(_buffer.data(), _size);
+            _size = 0;
+        }
+    }
+
+private:
+    const static size_t MAX_TOKEN_SIZE = 24;
+
+    inline void reserve(size_t length) {
+        if (_outputStream != nullptr && _size + length > FLUSH_SIZE) {
+            flush();
+        }
+        if (_size + length > _buffer.size()) {
+            _buffer.resize(std::max(_buffer.size() * 2, _size + length));
+        }
+    }
+
+    std::ostream* _outputStream;
+    std::vector<char> _buffer;
+    size_t _size;
+};
+
+#endif // TEXT_WRITER_H
@@ -5,6 +5,8 @@
 #include <chrono>
 #include <iostream>
 
+#include "cpu_dispatch.hpp"
+
 const int GLOBAL_RESERVATION = 1048576;
 const int THREAD_RESERVATION = 1024;
 
@@ -155,7 +157,7 @@ void TimeCollector::ThreadFinalize()
 
 void TimeCollector::PrintInfo(std::ostream &stream)
 {
-    stream << "// Verbose: 2" << std::endl;
+    stream << "// Verbose: 2, isa: " << CpuDispatch::getLevelName(CpuDispatch::getLevel()) << std::endl;
     stream << _globalList.size() << std::endl;
 
     for(auto i = _globalList.begin(); i != _globalList.end(); ++i) {
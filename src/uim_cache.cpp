@@ -0,0 +1,239 @@
+#include "uim_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+// Changed whenever calculation gives different results for the same input
+const uint32_t CACHE_VERSION = 1;
+
+const char CACHE_SUFFIX[] = ".uim";
+
+const uint64_t HASH_C1 = 0x87c37b91114253d5ULL;
+const uint64_t HASH_C2 = 0x4cf5ad432745937fULL;
+
+static inline uint64_t rotl(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+static inline uint64_t fmix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+ContentHash::ContentHash()
+    : _h1(0), _h2(0), _length(0)
+{
+}
+
+void ContentHash::add(const void* data, size_t size)
+{
+    auto bytes = static_cast<const char*>(data);
+
+    // Size is mixed in, so that pieces can't be shifted into each other
+    addWord(size);
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        addWord(word);
+    }
+
+    if (i < size) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes + i, size - i);
+        addWord(word);
+    }
+}
+
+std::string ContentHash::getHex() const
+{
+    auto h1 = _h1 ^ _length;
+    auto h2 = _h2 ^ _length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    char hex[33];
+    snprintf(hex, sizeof(hex), "%016llx%016llx",
+             static_cast<unsigned long long>(h1), static_cast<unsigned long long>(h2));
+    return std::string(hex);
+}
+
+void ContentHash::addWord(uint64_t word)
+{
+    auto k1 = rotl(word * HASH_C1, 31) * HASH_C2;
+    _h1 ^= k1;
+    _h1 = (rotl(_h1, 27) + _h2) * 5 + 0x52dce729;
+
+    auto k2 = rotl(word * HASH_C2, 33) * HASH_C1;
+    _h2 ^= k2;
+    _h2 = (rotl(_h2, 31) + _h1) * 5 + 0x38495ab5;
+
+    _length += sizeof(word);
+}
+
+UimCache::UimCache(const std::string& directory, size_t sizeLimit)
+    : _directory(directory), _sizeLimit(sizeLimit)
+{
+}
+
+std::string UimCache::getKey(const DataFile& dataFile, const std::string& options)
+{
+    ContentHash hash;
+    hash.addValue(CACHE_VERSION);
+    hash.addValue<uint32_t>(sizeof(feature_t));
+    hash.addValue<uint32_t>(sizeof(weight_t));
+
+    auto learningSetLen = static_cast<size_t>(dataFile.getLearningSetLen());
+    hash.addValue(dataFile.getLearningSetLen());
+    hash.addValue(dataFile.getFeaturesLen());
+    hash.addValue(dataFile.getPfeaturesLen());
+    hash.add(dataFile.getLearningSetFeatures(), learningSetLen * dataFile.getFeaturesLen() * sizeof(feature_t));
+    hash.add(dataFile.getLearningSetPfeatures(), learningSetLen * dataFile.getPfeaturesLen() * sizeof(feature_t));
+
+    if (dataFile.getRangesMin() != nullptr && dataFile.getRangesMax() != nullptr) {
+        hash.add(dataFile.getRangesMin(), dataFile.getFeaturesLen() * sizeof(feature_t));
+        hash.add(dataFile.getRangesMax(), dataFile.getFeaturesLen() * sizeof(feature_t));
+    }
+
+    hash.add(options.data(), options.size());
+    return hash.getHex();
+}
+
+bool UimCache::load(const std::string& key)
+{
+    auto path = getPath(key);
+    if (access(path.c_str(), R_OK) != 0) {
+        return false;
+    }
+
+    // Broken entry is just a miss, it's replaced by the calculated result
+    try {
+        _entry.load(path);
+    } catch (const std::exception&) {
+        _entry.reset();
+        return false;
+    }
+
+    if (_entry.getUimSet() == nullptr || _entry.getUimWeights() == nullptr) {
+        _entry.reset();
+        return false;
+    }
+
+    // Modification time marks recently used entries
+    utime(path.c_str(), nullptr);
+    return true;
+}
+
+void UimCache::fill(DataFile& dataFile) const
+{
+    auto size = static_cast<size_t>(_entry.getUimSetLen()) * _entry.getFeaturesLen();
+    auto uim = new feature_t[size];
+    std::copy(_entry.getUimSet(), _entry.getUimSet() + size, uim);
+
+    auto uimWeights = new weight_t[_entry.getFeaturesLen()];
+    std::copy(_entry.getUimWeights(), _entry.getUimWeights() + _entry.getFeaturesLen(), uimWeights);
+
+    dataFile.setUimBlock(uim, _entry.getUimSetLen(), _entry.getFeaturesLen());
+    dataFile.setUimWeightsBlock(uimWeights, _entry.getFeaturesLen());
+}
+
+void UimCache::store(const std::string& key, const DataFile& dataFile)
+{
+    if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create cache directory " + _directory);
+    }
+
+    auto size = static_cast<size_t>(dataFile.getUimSetLen()) * dataFile.getFeaturesLen();
+    auto uim = new feature_t[size];
+    std::copy(dataFile.getUimSet(), dataFile.getUimSet() + size, uim);
+
+    auto uimWeights = new weight_t[dataFile.getFeaturesLen()];
+    std::copy(dataFile.getUimWeights(), dataFile.getUimWeights() + dataFile.getFeaturesLen(), uimWeights);
+
+    DataFile entry;
+    entry.setBinary(true);
+    entry.setUimBlock(uim, dataFile.getUimSetLen(), dataFile.getFeaturesLen());
+    entry.setUimWeightsBlock(uimWeights, dataFile.getFeaturesLen());
+
+    // Entry appears at once, so concurrent runs never read it partially
+    auto path = getPath(key);
+    auto tempPath = path + "." + std::to_string(getpid()) + ".tmp";
+    entry.save(tempPath);
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw std::runtime_error("Cannot store cache entry " + path);
+    }
+
+    evict(path);
+}
+
+std::string UimCache::getPath(const std::string& key) const
+{
+    return _directory + "/" + key + CACHE_SUFFIX;
+}
+
+void UimCache::evict(const std::string& keptPath)
+{
+    struct Entry {
+        std::string path;
+        time_t time;
+        size_t size;
+    };
+
+    auto directory = opendir(_directory.c_str());
+    if (directory == nullptr) {
+        return;
+    }
+
+    std::vector<Entry> entries;
+    size_t totalSize = 0;
+    auto suffixLen = strlen(CACHE_SUFFIX);
+    while (auto item = readdir(directory)) {
+        std::string name(item->d_name);
+        if (name.size() <= suffixLen || name.compare(name.size() - suffixLen, suffixLen, CACHE_SUFFIX) != 0) {
+            continue;
+        }
+
+        auto path = _directory + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            entries.push_back({path, info.st_mtime, static_cast<size_t>(info.st_size)});
+            totalSize += info.st_size;
+        }
+    }
+    closedir(directory);
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.time < b.time;
+    });
+
+    for (auto& entry : entries) {
+        if (totalSize <= _sizeLimit) {
+            break;
+        }
+        if (entry.path != keptPath && std::remove(entry.path.c_str()) == 0) {
+            totalSize -= entry.size;
+        }
+    }
+}
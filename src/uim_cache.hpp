@@ -0,0 +1,62 @@
+#ifndef UIM_CACHE_H
+#define UIM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "datafile.hpp"
+
+// 128-bit hash of a sequence of data pieces, every 8-byte word is mixed
+// into two 64-bit lanes in the way of MurmurHash3
+class ContentHash
+{
+public:
+    ContentHash();
+
+    void add(const void* data, size_t size);
+    std::string getHex() const;
+
+    template<typename T>
+    inline void addValue(T value) {
+        add(&value, sizeof(value));
+    }
+
+private:
+    void addWord(uint64_t word);
+
+private:
+    uint64_t _h1;
+    uint64_t _h2;
+    uint64_t _length;
+};
+
+// Directory of uim results, every entry is a binary data file with uim and
+// uim_weights blocks named by hash of learning set, ranges and options of
+// calculation. Entries are touched on every hit, the least recently used
+// ones are removed when total size exceeds the limit
+class UimCache
+{
+public:
+    UimCache(const std::string& directory, size_t sizeLimit);
+
+    // Hex hash of learning set, ranges and options, it also identifies
+    // input of checkpoints
+    static std::string getKey(const DataFile& dataFile, const std::string& options);
+
+    bool load(const std::string& key);
+    void fill(DataFile& dataFile) const;
+    void store(const std::string& key, const DataFile& dataFile);
+
+private:
+    std::string getPath(const std::string& key) const;
+    void evict(const std::string& keptPath);
+
+private:
+    std::string _directory;
+    size_t _sizeLimit;
+
+    DataFile _entry;
+};
+
+#endif // UIM_CACHE_H
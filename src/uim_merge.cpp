@@ -0,0 +1,202 @@
+#include <iostream>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef MULTITHREAD
+#include <atomic>
+#include <thread>
+#endif
+
+#include "../argparse-port/argparse.h"
+
+#include "global_settings.h"
+#include "cpu_dispatch.hpp"
+#include "datafile.hpp"
+#include "timecollector.hpp"
+#include "irredundant_matrix.hpp"
+
+INIT_DEBUG_OUTPUT();
+
+void loadDataFile(const std::string& path, DataFile& dataFile);
+void parallelFor(int count, const std::function<void(int)>& body);
+
+int main(int argc, char** argv)
+{
+    parser_t* parser;
+    parser_init(&parser);
+
+    parser_string_arg_t* input_arg;
+    parser_string_add_arg(parser, &input_arg, "input");
+    parser_string_set_help(input_arg, "file with list of partial results of uim shards, one per line");
+
+    parser_string_arg_t* output_arg;
+    parser_string_add_arg(parser, &output_arg, "output");
+    parser_string_set_help(output_arg, "output file");
+
+    parser_flag_arg_t* no_transfer;
+    parser_flag_add_arg(parser, &no_transfer, "--no-transfer");
+    parser_flag_set_help(no_transfer, "no transfer blocks from the first partial result to output");
+
+    parser_string_arg_t* isa_arg;
+    parser_string_add_arg(parser, &isa_arg, "--isa");
+    parser_string_set_help(isa_arg, "force instruction set of kernels: baseline, avx2 or avx512, "
+                                    "the best supported one is used by default");
+    parser_string_set_default(isa_arg, "");
+
+    if (parser_parse(parser, argc, argv) != PARSER_RESULT_OK) {
+        printf("%s", parser_get_last_err(parser));
+        parser_free(&parser);
+        return 1;
+    }
+
+    if (!CpuDispatch::forceLevel(parser_string_get_value(isa_arg))) {
+        printf("Instruction set should be baseline, avx2 or avx512 and supported by CPU\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    TimeCollector::Initialize();
+    TimeCollector::ThreadInitialize();
+    TimeCollectorEntry executionTime(Counters::All);
+
+    START_COLLECT_TIME(readingInput, Counters::ReadingInput);
+    std::vector<std::string> paths;
+    {
+        std::ifstream listFile;
+        if (strcmp("-", parser_string_get_value(input_arg)) != 0) {
+            listFile.open(parser_string_get_value(input_arg));
+        }
+        std::istream& list = listFile.is_open() ? listFile : std::cin;
+
+        std::string path;
+        while (std::getline(list, path)) {
+            if (!path.empty()) {
+                paths.push_back(path);
+            }
+        }
+    }
+
+    if (paths.empty()) {
+        printf("No partial results are given\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    DataFile dataFile;
+    loadDataFile(paths[0], dataFile);
+    auto width = dataFile.getFeaturesLen();
+    STOP_COLLECT_TIME(readingInput);
+
+    std::vector<std::unique_ptr<IrredundantMatrix>> matrices(paths.size());
+    parallelFor(paths.size(), [&](int i)
+    {
+        matrices[i].reset(new IrredundantMatrix(width));
+        if (i == 0) {
+            matrices[i]->load(dataFile);
+            return;
+        }
+
+        DataFile partial;
+        loadDataFile(paths[i], partial);
+        if (partial.getFeaturesLen() != width) {
+            throw std::runtime_error("Partial result " + paths[i] + " has different amount of features");
+        }
+        matrices[i]->load(partial);
+    });
+
+    // Pairwise reduction, every step halves amount of matrices and all merges
+    // of the same step are independent
+    for (size_t step = 1; step < matrices.size(); step *= 2) {
+        parallelFor((matrices.size() + 2 * step - 1) / (2 * step), [&](int pair)
+        {
+            auto first = pair * 2 * step;
+            auto second = first + step;
+            if (second < matrices.size()) {
+                matrices[first]->addMatrixConcurrent(std::move(*matrices[second]));
+                matrices[second].reset();
+            }
+        });
+    }
+
+    START_COLLECT_TIME(writingOutput, Counters::WritingOutput);
+    DataFile result;
+    result.setBinary(dataFile.isBinary());
+    if (!parser_flag_is_filled(no_transfer)) {
+        result.transfer(dataFile);
+    }
+    dataFile.reset();
+
+    matrices[0]->fill(result);
+
+    if (strcmp("-", output_arg->value) != 0) {
+        result.save(std::string(output_arg->value));
+    } else {
+        result.save(std::cout);
+    }
+    STOP_COLLECT_TIME(writingOutput);
+
+    executionTime.Stop();
+    std::ofstream timeCollectorOutput("current_profile.txt");
+
+    TimeCollector::ThreadFinalize();
+    TimeCollector::PrintInfo(timeCollectorOutput);
+
+    parser_free(&parser);
+    return 0;
+}
+
+void loadDataFile(const std::string& path, DataFile& dataFile)
+{
+    dataFile.setParsedBlocks(DataFile::UimBlock | DataFile::UimWeightsBlock);
+    dataFile.load(path);
+
+    if (dataFile.getUimSet() == nullptr) {
+        throw std::runtime_error("Partial result " + path + " has no uim block");
+    }
+}
+
+void parallelFor(int count, const std::function<void(int)>& body)
+{
+#ifdef MULTITHREAD
+    std::atomic<int> current(0);
+    std::vector<std::thread> threads(std::min<int>(count, std::thread::hardware_concurrency()));
+    std::vector<std::exception_ptr> errors(count);
+
+    for(auto& thread : threads) {
+        START_COLLECT_TIME(threading, Counters::Threading);
+        thread = std::thread([&body, &current, &errors, count]()
+        {
+            TimeCollector::ThreadInitialize();
+            for(auto i = current.fetch_add(1); i < count; i = current.fetch_add(1)) {
+                try {
+                    body(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+            TimeCollector::ThreadFinalize();
+        });
+        STOP_COLLECT_TIME(threading);
+    }
+
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    // The first error by index is reported, as in single thread mode
+    for(auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+#else
+    for(auto i = 0; i < count; ++i) {
+        body(i);
+    }
+#endif
+}
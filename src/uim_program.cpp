@@ -1,15 +1,22 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <cstdlib>
 #include <map>
+#include <memory>
+#include <string>
 
 #include "../argparse-port/argparse.h"
 
 #include "global_settings.h"
+#include "cpu_dispatch.hpp"
 #include "datafile.hpp"
 #include "timecollector.hpp"
 #include "input_matrix.hpp"
 #include "irredundant_matrix.hpp"
+#include "chunked_matrix.hpp"
+#include "checkpoint.hpp"
+#include "uim_cache.hpp"
 
 INIT_DEBUG_OUTPUT();
 
@@ -32,12 +39,153 @@ int main(int argc, char** argv)
     parser_flag_add_arg(parser, &no_transfer, "--no-transfer");
     parser_flag_set_help(no_transfer, "no transfer blocks from input file to output");
 
+    parser_int_arg_t* memory_limit_arg;
+    parser_int_add_arg(parser, &memory_limit_arg, "--memory-limit");
+    parser_int_set_alt(memory_limit_arg, "-m");
+    parser_int_set_help(memory_limit_arg, "process learning set out of core, chunks of all workers take "
+                                          "this amount of MB, learning set isn't transferred to output");
+    parser_int_set_default(memory_limit_arg, 0);
+
+    parser_int_arg_t* irredundant_limit_arg;
+    parser_int_add_arg(parser, &irredundant_limit_arg, "--irredundant-limit");
+    parser_int_set_help(irredundant_limit_arg, "spill irredundant matrix to disk above this size in MB");
+    parser_int_set_default(irredundant_limit_arg, 0);
+
+    parser_string_arg_t* sample_rate_arg;
+    parser_string_add_arg(parser, &sample_rate_arg, "--sample-rate");
+    parser_string_set_help(sample_rate_arg, "process only this fraction of pairs of every class pair, "
+                                            "weights are estimated");
+    parser_string_set_default(sample_rate_arg, "1");
+
+    parser_int_arg_t* sample_seed_arg;
+    parser_int_add_arg(parser, &sample_seed_arg, "--sample-seed");
+    parser_int_set_help(sample_seed_arg, "seed for choosing of sampled pairs");
+    parser_int_set_default(sample_seed_arg, 0);
+
+    parser_flag_arg_t* verify_sample;
+    parser_flag_add_arg(parser, &verify_sample, "--verify-sample");
+    parser_flag_set_help(verify_sample, "check all pairs against sampled matrix to get exact result");
+
+    parser_string_arg_t* shard_arg;
+    parser_string_add_arg(parser, &shard_arg, "--shard");
+    parser_string_set_help(shard_arg, "process only k-th of N shards of class pairs, "
+                                      "given as k/N with 1 <= k <= N");
+    parser_string_set_default(shard_arg, "1/1");
+
+    parser_string_arg_t* checkpoint_arg;
+    parser_string_add_arg(parser, &checkpoint_arg, "--checkpoint");
+    parser_string_set_help(checkpoint_arg, "periodically save calculation state to this file");
+    parser_string_set_default(checkpoint_arg, "");
+
+    parser_int_arg_t* checkpoint_interval_arg;
+    parser_int_add_arg(parser, &checkpoint_interval_arg, "--checkpoint-interval");
+    parser_int_set_help(checkpoint_interval_arg, "interval between checkpoints in seconds");
+    parser_int_set_default(checkpoint_interval_arg, 600);
+
+    parser_flag_arg_t* resume;
+    parser_flag_add_arg(parser, &resume, "--resume");
+    parser_flag_set_help(resume, "continue calculation from checkpoint file if it exists");
+
+    parser_string_arg_t* temp_dir_arg;
+    parser_string_add_arg(parser, &temp_dir_arg, "--temp-dir");
+    parser_string_set_help(temp_dir_arg, "directory for temporary files");
+    parser_string_set_default(temp_dir_arg, ".");
+
+    parser_string_arg_t* cache_dir_arg;
+    parser_string_add_arg(parser, &cache_dir_arg, "--cache-dir");
+    parser_string_set_help(cache_dir_arg, "directory of results cached by learning set and options");
+    parser_string_set_default(cache_dir_arg, "");
+
+    parser_int_arg_t* cache_size_arg;
+    parser_int_add_arg(parser, &cache_size_arg, "--cache-size");
+    parser_int_set_help(cache_size_arg, "size limit of cache directory in MB, "
+                                        "least recently used results are removed above it");
+    parser_int_set_default(cache_size_arg, 1024);
+
+    parser_flag_arg_t* no_cache;
+    parser_flag_add_arg(parser, &no_cache, "--no-cache");
+    parser_flag_set_help(no_cache, "calculate uim without looking it up in cache, "
+                                   "the result still replaces cached one");
+
+    parser_string_arg_t* isa_arg;
+    parser_string_add_arg(parser, &isa_arg, "--isa");
+    parser_string_set_help(isa_arg, "force instruction set of kernels: baseline, avx2 or avx512, "
+                                    "the best supported one is used by default");
+    parser_string_set_default(isa_arg, "");
+
     if (parser_parse(parser, argc, argv) != PARSER_RESULT_OK) {
         printf("%s", parser_get_last_err(parser));
         parser_free(&parser);
         return 1;
     }
 
+    if (!CpuDispatch::forceLevel(parser_string_get_value(isa_arg))) {
+        printf("Instruction set should be baseline, avx2 or avx512 and supported by CPU\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    char* sampleRateEnd = nullptr;
+    auto sampleRate = std::strtod(parser_string_get_value(sample_rate_arg), &sampleRateEnd);
+    if (sampleRateEnd == parser_string_get_value(sample_rate_arg) || *sampleRateEnd != '\0'
+        || !(sampleRate > 0 && sampleRate <= 1)) {
+        printf("Sample rate should be in (0, 1]\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    if (sampleRate < 1 && parser_int_get_value(memory_limit_arg) > 0) {
+        printf("Sampling isn't supported with memory limit\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    int shard, shardsCount;
+    if (sscanf(parser_string_get_value(shard_arg), "%d/%d", &shard, &shardsCount) != 2
+        || shardsCount < 1 || shard < 1 || shard > shardsCount) {
+        printf("Shard should be given as k/N with 1 <= k <= N\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    auto useShard = shardsCount > 1;
+    if (useShard && (sampleRate < 1 || parser_int_get_value(memory_limit_arg) > 0
+                     || strlen(parser_string_get_value(checkpoint_arg)) > 0)) {
+        printf("Sharding isn't supported with sampling, memory limit or checkpoint\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    auto useCheckpoint = strlen(parser_string_get_value(checkpoint_arg)) > 0;
+    if (useCheckpoint && (sampleRate < 1 || parser_int_get_value(memory_limit_arg) > 0)) {
+        printf("Checkpoint isn't supported with sampling or memory limit\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    if (parser_flag_is_filled(resume) && !useCheckpoint) {
+        printf("Resume requires checkpoint file\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    auto useCache = strlen(parser_string_get_value(cache_dir_arg)) > 0;
+    if (useCache && parser_int_get_value(memory_limit_arg) > 0) {
+        printf("Cache isn't supported with memory limit\n");
+        parser_free(&parser);
+        return 1;
+    }
+
+    // Only options which change the result are the part of the key
+    std::string cacheOptions = "shard=" + std::to_string(shard) + "/" + std::to_string(shardsCount);
+    if (sampleRate < 1) {
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.17g", sampleRate);
+        cacheOptions += std::string(";sample=") + rate
+                        + "/" + std::to_string(parser_int_get_value(sample_seed_arg))
+                        + (parser_flag_is_filled(verify_sample) ? "/verified" : "");
+    }
+
 #ifdef DEBUG_MODE
     printBuildFlags(getDebugStream());
 #endif
@@ -48,37 +196,104 @@ int main(int argc, char** argv)
 
     START_COLLECT_TIME(readingInput, Counters::ReadingInput);
     DataFile dataFile;
+    ChunkedMatrix chunkedMatrix(static_cast<size_t>(parser_int_get_value(memory_limit_arg)) * 1048576,
+                                parser_string_get_value(temp_dir_arg));
+    auto outOfCore = parser_int_get_value(memory_limit_arg) > 0;
+    dataFile.setParsedBlocks(DataFile::LearningSetBlock | DataFile::RangesBlock);
+    if (outOfCore) {
+        dataFile.setLearningSetConsumer(&chunkedMatrix);
+    }
+
     if (strcmp("-", parser_string_get_value(input_arg)) != 0) {
-        std::ifstream input_stream(parser_string_get_value(input_arg));
-        dataFile.load(input_stream);
+        dataFile.load(std::string(parser_string_get_value(input_arg)));
     } else {
         dataFile.load(std::cin);
     }
-    InputMatrix inputMatrix(dataFile);
+
+    UimCache uimCache(parser_string_get_value(cache_dir_arg),
+                      static_cast<size_t>(parser_int_get_value(cache_size_arg)) * 1048576);
+    std::string cacheKey;
+    auto cacheHit = false;
+    if (useCache) {
+        cacheKey = UimCache::getKey(dataFile, cacheOptions);
+        cacheHit = !parser_flag_is_filled(no_cache) && uimCache.load(cacheKey);
+    }
+
+    std::unique_ptr<InputMatrix> inputMatrix;
+    if (!outOfCore && !cacheHit) {
+        inputMatrix.reset(new InputMatrix(dataFile));
+    }
     STOP_COLLECT_TIME(readingInput);
 
 #ifdef DEBUG_MODE
-    inputMatrix.printFeatureMatrix(getDebugStream());
-    inputMatrix.printImageMatrix(getDebugStream());
-    inputMatrix.printDebugInfo(getDebugStream());
+    if (inputMatrix) {
+        inputMatrix->printFeatureMatrix(getDebugStream());
+        inputMatrix->printImageMatrix(getDebugStream());
+        inputMatrix->printDebugInfo(getDebugStream());
+    }
 #endif
 
-    IrredundantMatrix irredundantMatrix(inputMatrix.getFeatureWidth());
-    inputMatrix.calculate(irredundantMatrix);
+    IrredundantMatrix irredundantMatrix(outOfCore
+                                        ? chunkedMatrix.getFeatureWidth()
+                                        : inputMatrix ? inputMatrix->getFeatureWidth()
+                                                      : dataFile.getFeaturesLen());
+    if (inputMatrix) {
+        irredundantMatrix.setFeatureMapping(inputMatrix->getFeatureMapping());
+    }
+    irredundantMatrix.setMemoryLimit(static_cast<size_t>(parser_int_get_value(irredundant_limit_arg)) * 1048576,
+                                     parser_string_get_value(temp_dir_arg));
+    if (cacheHit) {
+        // Result is taken from cache as is
+    } else if (outOfCore) {
+        chunkedMatrix.calculate(irredundantMatrix, dataFile);
+    } else if (sampleRate < 1) {
+        inputMatrix->calculateSampled(irredundantMatrix, sampleRate, parser_int_get_value(sample_seed_arg),
+                                      parser_flag_is_filled(verify_sample));
+    } else if (useShard) {
+        inputMatrix->calculateShard(irredundantMatrix, shard - 1, shardsCount);
+    } else if (useCheckpoint) {
+        Checkpoint checkpoint(parser_string_get_value(checkpoint_arg),
+                              parser_int_get_value(checkpoint_interval_arg),
+                              inputMatrix->getTasksCount(),
+                              UimCache::getKey(dataFile, cacheOptions));
+        if (parser_flag_is_filled(resume)) {
+            checkpoint.load(irredundantMatrix);
+        }
+
+        checkpoint.start(irredundantMatrix);
+        inputMatrix->setCheckpoint(&checkpoint);
+        inputMatrix->calculate(irredundantMatrix);
+        inputMatrix->setCheckpoint(nullptr);
+        checkpoint.stop();
+    } else {
+        inputMatrix->calculate(irredundantMatrix);
+    }
 
     if (parser_flag_is_filled(no_transfer)) {
         dataFile.reset();
     }
 
     START_COLLECT_TIME(writingOutput, Counters::WritingOutput);
-    irredundantMatrix.fill(dataFile);
+    if (cacheHit) {
+        uimCache.fill(dataFile);
+    } else {
+        irredundantMatrix.fill(dataFile);
+    }
 
     if (strcmp("-", output_arg->value) != 0) {
-        std::ofstream output_stream(output_arg->value);
-        dataFile.save(output_stream);
+        dataFile.save(std::string(output_arg->value));
     } else {
         dataFile.save(std::cout);
     }
+
+    // Output is already written, so failure of cache only loses the entry
+    if (useCache && !cacheHit) {
+        try {
+            uimCache.store(cacheKey, dataFile);
+        } catch (const std::exception& error) {
+            std::cerr << "Result isn't cached: " << error.what() << std::endl;
+        }
+    }
     STOP_COLLECT_TIME(writingOutput);
 
 #ifdef DEBUG_MODE
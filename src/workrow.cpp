@@ -2,9 +2,9 @@
 
 #include <stdexcept>
 
-WorkRow::WorkRow(int* matrix, int index, int width) {
+WorkRow::WorkRow(const int* matrix, int index, int width) {
     _matrix = matrix;
-    _offset = index * width;
+    _offset = static_cast<size_t>(index) * width;
     _width = width;
 }
 
@@ -1,10 +1,12 @@
 #ifndef WORKROW_H
 #define WORKROW_H
 
+#include <cstddef>
+
 class WorkRow
 {
 public:
-    WorkRow(int* matrix, int index, int width);
+    WorkRow(const int* matrix, int index, int width);
 
     bool operator<(const WorkRow& rhs) const;
 
@@ -13,8 +15,8 @@ public:
         return _matrix[_offset + index];
     }
 
-    inline void setValue(int index, int value) {
-        _matrix[_offset + index] = value;
+    inline const int* getValues() const {
+        return _matrix + _offset;
     }
 
     inline unsigned int getWidth() const {
@@ -22,8 +24,8 @@ public:
     }
 
 private:
-    int* _matrix;
-    int _offset;
+    const int* _matrix;
+    size_t _offset;
     int _width;
 };
 